@@ -0,0 +1,131 @@
+/* Simple bump/arena allocator.
+ * Memory is carved out of large chunks and released all at once, individual allocations are never freed.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <utility>
+
+class Arena {
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+    };
+    static const size_t MAX_CHUNK = 64 * 1024 * 1024;
+    Chunk* head = nullptr;
+    char* ptr = nullptr;
+    char* end = nullptr;
+    size_t chunksize;
+    size_t used = 0;
+
+    void* grow(size_t size, size_t align) {
+        // chunk sizes double so a large parse only ever has O(log n) chunks to free
+        size_t want = size + align + sizeof(Chunk);
+        size_t csize = head == nullptr ? chunksize : head->size * 2;
+        if (csize > MAX_CHUNK) {
+            csize = MAX_CHUNK;
+        }
+        if (csize < want) {
+            csize = want;
+        }
+        Chunk* c = (Chunk*) malloc(csize);
+        if (c == nullptr) {
+            printf("Arena out of memory\n");
+            throw std::exception();
+        }
+        c->next = head;
+        c->size = csize;
+        head = c;
+        ptr = (char*)c + sizeof(Chunk);
+        end = (char*)c + csize;
+        return alloc(size, align);
+    }
+
+    public:
+    /* Construct an empty Arena. The first chunk is allocated on first use. */
+    Arena(size_t chunksize=64*1024) {
+        this->chunksize = chunksize < 256 ? 256 : chunksize;
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&& o) {
+        head = o.head;
+        ptr = o.ptr;
+        end = o.end;
+        chunksize = o.chunksize;
+        used = o.used;
+        o.head = nullptr;
+        o.ptr = o.end = nullptr;
+        o.used = 0;
+    }
+    Arena& operator=(Arena&& o) {
+        if (this != &o) {
+            release();
+            std::swap(head, o.head);
+            std::swap(ptr, o.ptr);
+            std::swap(end, o.end);
+            std::swap(used, o.used);
+            chunksize = o.chunksize;
+        }
+        return *this;
+    }
+    ~Arena() {
+        release();
+    }
+
+    /* Allocate size bytes aligned to align (a power of two). */
+    inline void* alloc(size_t size, size_t align=alignof(std::max_align_t)) {
+        char* p = (char*)(((size_t)ptr + align - 1) & ~(align - 1));
+        if (ptr == nullptr || p + size > end) {
+            return grow(size, align);
+        }
+        ptr = p + size;
+        used += size;
+        return p;
+    }
+    /* Allocate and construct a T. Note that destructors of Arena objects are never run. */
+    template<class T, class... Args>
+    inline T* create(Args&&... args) {
+        return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    /* Allocate and default construct an array of count T. */
+    template<class T>
+    inline T* array(size_t count) {
+        T* a = (T*) alloc(sizeof(T) * count, alignof(T));
+        for (size_t i=0; i<count; i++) {
+            new (&a[i]) T();
+        }
+        return a;
+    }
+    /* Copy len bytes of s into the Arena, adding a NUL terminator. */
+    inline char* strdup(const char* s, size_t len) {
+        char* r = (char*) alloc(len + 1, 1);
+        memcpy(r, s, len);
+        r[len] = 0;
+        return r;
+    }
+    inline char* strdup(const char* s) {
+        return strdup(s, strlen(s));
+    }
+    /* Returns the number of bytes handed out since the last release. */
+    inline size_t bytesUsed() {
+        return used;
+    }
+    /* Free every chunk, invalidating all memory allocated from this Arena. */
+    void release() {
+        while (head != nullptr) {
+            Chunk* next = head->next;
+            free(head);
+            head = next;
+        }
+        ptr = end = nullptr;
+        used = 0;
+    }
+};
@@ -4,6 +4,8 @@
  */
 #pragma once
 
+#include <cstddef>
+
 template<class T>
 class RWBuffer {
     protected:
@@ -112,8 +114,12 @@ class RWBuffer {
 
 template<class T>
 class RBuffer : public RWBuffer<T> {
-    inline bool write(T v) {}
-    inline size_t write(T* v, size_t amount) {}
+    inline bool write(T v) {
+        return false;
+    }
+    inline size_t write(T* v, size_t amount) {
+        return 0;
+    }
     inline bool writeable() {
         return false;
     }
@@ -121,9 +127,15 @@ class RBuffer : public RWBuffer<T> {
 
 template<class T>
 class WBuffer : public RWBuffer<T> {
-    inline T read() {}
-    inline bool read(T& v) {}
-    inline size_t read(T* v, size_t amount) {}
+    inline T read() {
+        return T();
+    }
+    inline bool read(T& v) {
+        return false;
+    }
+    inline size_t read(T* v, size_t amount) {
+        return 0;
+    }
     inline bool readable() {
         return false;
     }
@@ -0,0 +1,510 @@
+/* Thread safe string keyed dictionary, for sharing one table between threads without a global lock.
+ * Keys are split over shards by hash. Writers lock only the shard they change, readers take no locks and never write
+ * shared state, so lookups are wait-free and don't slow each other down.
+ * Entries are immutable once published: setting a key publishes a new entry, and replaced or removed entries
+ * are freed by epoch based reclamation once no reader can still be looking at them.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  ConcurrentDictionary<Asset*> assets;
+ *  assets.set("player.png", asset); // any thread
+ *  Asset* a;
+ *  if (assets.find("player.png", a)) { ... } // any thread
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string.h>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Dictionary.hpp"
+
+/* Epoch based reclamation, shared by every ConcurrentDictionary.
+ * Readers pin the current epoch while they look at shared memory. Memory that has been unlinked is retired with the epoch
+ * at that time, and may be freed once the epoch has advanced twice, since every reader that could have seen it has unpinned by then.
+ * The epoch only advances when every pinned thread has seen the current one.
+ */
+class EpochDomain {
+    public:
+    // one per thread, reused after the thread exits
+    class alignas(64) Record {
+        public:
+        // epoch pinned by the thread, or 0 when it isn't reading
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> taken{true};
+        Record* next = nullptr;
+        // pin nesting depth, only touched by the owning thread
+        size_t depth = 0;
+    };
+
+    /* Pins the epoch for as long as it is in scope. Guards may be nested. */
+    class Guard {
+        Record* r;
+        public:
+        Guard() : Guard(EpochDomain::instance()) {}
+        Guard(EpochDomain& domain) {
+            r = domain.local();
+            if (r->depth++ == 0) {
+                r->epoch.store(domain.global.load(std::memory_order_seq_cst), std::memory_order_relaxed);
+                // the pin must be visible before any shared memory is read
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+        ~Guard() {
+            if (--r->depth == 0) {
+                r->epoch.store(0, std::memory_order_release);
+            }
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    private:
+    // starts above 2 so that epoch - 2 never wraps
+    std::atomic<uint64_t> global{3};
+    std::atomic<Record*> records{nullptr};
+
+    // releases the thread's record when the thread exits
+    class Local {
+        public:
+        Record* r = nullptr;
+        ~Local() {
+            if (r != nullptr) {
+                r->taken.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    Record* acquire() {
+        for (Record* r = records.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            bool free = false;
+            if (!r->taken.load(std::memory_order_relaxed) && r->taken.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                return r;
+            }
+        }
+        // records are never freed, so the list can be walked without locking
+        Record* r = new Record();
+        Record* head = records.load(std::memory_order_relaxed);
+        do {
+            r->next = head;
+        } while (!records.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+        return r;
+    }
+
+    Record* local() {
+        thread_local Local l;
+        if (l.r == nullptr) {
+            l.r = acquire();
+        }
+        return l.r;
+    }
+
+    public:
+    /* Returns the domain shared by every ConcurrentDictionary. It is never destroyed, so threads may outlive main. */
+    static EpochDomain& instance() {
+        static EpochDomain* domain = new EpochDomain();
+        return *domain;
+    }
+
+    /* Returns the epoch to tag memory retired now with. Call after unlinking it. */
+    inline uint64_t current() {
+        return global.load(std::memory_order_seq_cst);
+    }
+
+    /* Advance the epoch if every pinned thread has seen the current one. Returns the epoch afterwards. */
+    uint64_t advance() {
+        uint64_t e = global.load(std::memory_order_seq_cst);
+        for (Record* r = records.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            uint64_t p = r->epoch.load(std::memory_order_seq_cst);
+            if (p != 0 && p != e) {
+                return e;
+            }
+        }
+        if (global.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst)) {
+            return e + 1;
+        }
+        // another thread advanced it
+        return e;
+    }
+
+    /* Returns true if memory retired at epoch tag can be freed, given an epoch returned by advance. */
+    static inline bool expired(uint64_t tag, uint64_t epoch) {
+        return tag + 2 <= epoch;
+    }
+};
+
+template<class T, size_t SHARDS=64, class Hash=WyHash>
+class ConcurrentDictionary {
+    static_assert(SHARDS > 0 && (SHARDS & (SHARDS - 1)) == 0, "SHARDS must be a power of two");
+
+    // entries are never modified once published
+    class Node {
+        public:
+        size_t hash;
+        size_t length;
+        char* key;
+        T value;
+        Node(const char* key, size_t length, size_t hash, T&& value) : hash(hash), length(length), value(std::move(value)) {
+            this->key = new char[length + 1];
+            memcpy(this->key, key, length);
+            this->key[length] = 0;
+        }
+        Node(const Node& o) = delete;
+        ~Node() {
+            delete [] key;
+        }
+    };
+
+    // open addressing with linear probing. Always keeps some slots empty, so every probe ends
+    class Table {
+        public:
+        size_t capacity;
+        std::atomic<Node*>* slots;
+        Table(size_t capacity) : capacity(capacity) {
+            slots = new std::atomic<Node*>[capacity];
+            for (size_t i=0; i<capacity; i++) {
+                slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        ~Table() {
+            delete [] slots;
+        }
+    };
+
+    class Retired {
+        public:
+        void* p;
+        void (*destroy)(void*);
+        uint64_t epoch;
+    };
+
+    class alignas(64) Shard {
+        public:
+        // held by writers only
+        std::mutex lock;
+        std::atomic<Table*> table{nullptr};
+        std::atomic<size_t> count{0};
+        // slots holding TOMBSTONE, which are reused by inserts and dropped when the table is rebuilt
+        size_t tombstones = 0;
+        // memory unlinked from this shard that readers may still see
+        std::vector<Retired> retired;
+    };
+
+    // marks a removed slot, so probes for keys stored past it keep going
+    static inline Node* tombstone() {
+        return reinterpret_cast<Node*>((uintptr_t)1);
+    }
+    // try to free retired memory once this many items are waiting
+    static const size_t RETIRE_BATCH = 64;
+
+    static constexpr int bits(size_t n) {
+        return n <= 1 ? 0 : 1 + bits(n >> 1);
+    }
+
+    Shard shards[SHARDS];
+    uint64_t seed;
+
+    inline size_t hashKey(const char* key, size_t n) {
+        return Hash::hash(key, n, seed);
+    }
+    inline size_t hashKey(const HashedKey<Hash>& key) {
+        return seed != 0 ? hashKey(key.key, key.length) : key.hash;
+    }
+    // the high bits pick the shard, the low bits the slot within it
+    inline Shard& shard(size_t h) {
+        return shards[bits(SHARDS) == 0 ? 0 : (h >> (sizeof(size_t) * 8 - bits(SHARDS)))];
+    }
+
+    static inline bool matches(const Node* e, const char* key, size_t n, size_t h) {
+        return e->hash == h && e->length == n && !memcmp(key, e->key, n);
+    }
+
+    // entry of table t for key, or nullptr, storing its slot in i.
+    // The slot is loaded once, as it may be changed by a writer at any time
+    static Node* lookup(Table* t, const char* key, size_t n, size_t h, size_t& i) {
+        size_t mask = t->capacity - 1;
+        for (i = h & mask; ; i = (i + 1) & mask) {
+            Node* e = t->slots[i].load(std::memory_order_acquire);
+            if (e == nullptr) {
+                return nullptr;
+            }
+            if (e != tombstone() && matches(e, key, n, h)) {
+                return e;
+            }
+        }
+    }
+
+    // entry for key, or nullptr. The caller must hold a Guard or the shard's lock
+    Node* search(const char* key, size_t n, size_t h) {
+        Table* t = shard(h).table.load(std::memory_order_acquire);
+        size_t i;
+        return t != nullptr ? lookup(t, key, n, h, i) : nullptr;
+    }
+
+    template<class U>
+    static void destroy(void* p) {
+        delete (U*)p;
+    }
+
+    // free p once no reader can see it. Called with the shard's lock held, after p is unlinked
+    template<class U>
+    void retire(Shard& s, U* p) {
+        s.retired.push_back(Retired{p, &destroy<U>, EpochDomain::instance().current()});
+        if (s.retired.size() >= RETIRE_BATCH) {
+            reclaim(s);
+        }
+    }
+
+    void reclaim(Shard& s) {
+        uint64_t epoch = EpochDomain::instance().advance();
+        size_t n = 0;
+        for (size_t i=0; i<s.retired.size(); i++) {
+            if (EpochDomain::expired(s.retired[i].epoch, epoch)) {
+                s.retired[i].destroy(s.retired[i].p);
+            } else {
+                s.retired[n++] = s.retired[i];
+            }
+        }
+        s.retired.resize(n);
+    }
+
+    // publish a new table for the shard sized for at least count+1 entries at under half load. Called with the lock held
+    Table* rebuild(Shard& s, Table* old) {
+        size_t count = s.count.load(std::memory_order_relaxed);
+        size_t size = 16;
+        while ((count + 1) * 2 > size) {
+            size *= 2;
+        }
+        Table* t = new Table(size);
+        if (old != nullptr) {
+            for (size_t i=0; i<old->capacity; i++) {
+                Node* e = old->slots[i].load(std::memory_order_relaxed);
+                if (e != nullptr && e != tombstone()) {
+                    size_t j = e->hash & (size - 1);
+                    while (t->slots[j].load(std::memory_order_relaxed) != nullptr) {
+                        j = (j + 1) & (size - 1);
+                    }
+                    t->slots[j].store(e, std::memory_order_relaxed);
+                }
+            }
+        }
+        s.table.store(t, std::memory_order_seq_cst);
+        s.tombstones = 0;
+        if (old != nullptr) {
+            // the entries moved to the new table, only the old slots are freed
+            retire(s, old);
+        }
+        return t;
+    }
+
+    // add or replace key. Returns true if it was added
+    bool put(const char* key, size_t n, size_t h, T&& value, bool replace) {
+        Shard& s = shard(h);
+        std::lock_guard<std::mutex> l(s.lock);
+        Table* t = s.table.load(std::memory_order_relaxed);
+        size_t count = s.count.load(std::memory_order_relaxed);
+        if (t == nullptr || (count + s.tombstones + 1) * 4 > t->capacity * 3) {
+            t = rebuild(s, t);
+        }
+        size_t mask = t->capacity - 1;
+        size_t free = t->capacity;
+        size_t i = h & mask;
+        for (; ; i = (i + 1) & mask) {
+            Node* e = t->slots[i].load(std::memory_order_relaxed);
+            if (e == nullptr) {
+                break;
+            }
+            if (e == tombstone()) {
+                if (free == t->capacity) {
+                    free = i;
+                }
+            } else if (matches(e, key, n, h)) {
+                if (replace) {
+                    t->slots[i].store(new Node(key, n, h, std::move(value)), std::memory_order_seq_cst);
+                    retire(s, e);
+                }
+                return false;
+            }
+        }
+        if (free < t->capacity) {
+            s.tombstones--;
+        } else {
+            free = i;
+        }
+        t->slots[free].store(new Node(key, n, h, std::move(value)), std::memory_order_seq_cst);
+        s.count.store(count + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool erase(const char* key, size_t n, size_t h) {
+        Shard& s = shard(h);
+        std::lock_guard<std::mutex> l(s.lock);
+        Table* t = s.table.load(std::memory_order_relaxed);
+        if (t == nullptr) {
+            return false;
+        }
+        size_t i;
+        Node* e = lookup(t, key, n, h, i);
+        if (e == nullptr) {
+            return false;
+        }
+        t->slots[i].store(tombstone(), std::memory_order_seq_cst);
+        s.tombstones++;
+        s.count.store(s.count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        retire(s, e);
+        return true;
+    }
+
+    template<class F>
+    bool visit(const char* key, size_t n, size_t h, F& f) {
+        EpochDomain::Guard g;
+        Node* e = search(key, n, h);
+        if (e == nullptr) {
+            return false;
+        }
+        f((const T&)e->value);
+        return true;
+    }
+
+    public:
+	/* Construct an empty ConcurrentDictionary. A nonzero seed is mixed into every hash, see Dictionary::setSeed. */
+    ConcurrentDictionary(uint64_t seed=0) : seed(seed) {}
+    ConcurrentDictionary(const ConcurrentDictionary&) = delete;
+    ConcurrentDictionary& operator=(const ConcurrentDictionary&) = delete;
+	/* Frees every entry. No other thread may be using the ConcurrentDictionary. */
+    ~ConcurrentDictionary() {
+        for (Shard& s : shards) {
+            Table* t = s.table.load(std::memory_order_relaxed);
+            if (t != nullptr) {
+                for (size_t i=0; i<t->capacity; i++) {
+                    Node* e = t->slots[i].load(std::memory_order_relaxed);
+                    if (e != nullptr && e != tombstone()) {
+                        delete e;
+                    }
+                }
+                delete t;
+            }
+            for (Retired& r : s.retired) {
+                r.destroy(r.p);
+            }
+        }
+    }
+
+	/* Returns the number of key:value pairs. Only exact while no other thread is writing. */
+    size_t length() {
+        size_t n = 0;
+        for (Shard& s : shards) {
+            n += s.count.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+	/* Copies the value for key into out and returns true, or returns false if the key isn't set. Wait-free. */
+    bool find(const HashedKey<Hash>& key, T& out) {
+        auto copy = [&](const T& v) {
+            out = v;
+        };
+        return visit(key.key, key.length, hashKey(key), copy);
+    }
+    inline bool find(std::string_view key, T& out) {
+        auto copy = [&](const T& v) {
+            out = v;
+        };
+        return visit(key.data(), key.size(), hashKey(key.data(), key.size()), copy);
+    }
+    inline bool find(const char* key, T& out) {
+        return find(std::string_view(key), out);
+    }
+	/* Returns the value for key, or def if the key isn't set. Wait-free. */
+    inline T get(std::string_view key, T def=T()) {
+        find(key, def);
+        return def;
+    }
+    inline T get(const HashedKey<Hash>& key, T def=T()) {
+        find(key, def);
+        return def;
+    }
+	/* Returns true if the key is set. Wait-free. */
+    inline bool has(std::string_view key) {
+        EpochDomain::Guard g;
+        return search(key.data(), key.size(), hashKey(key.data(), key.size())) != nullptr;
+    }
+    inline bool has(const HashedKey<Hash>& key) {
+        EpochDomain::Guard g;
+        return search(key.key, key.length, hashKey(key)) != nullptr;
+    }
+	/* Calls f(const T& value) with the value for key without copying it, and returns true, or returns false if the key isn't set.
+	   The value stays valid until f returns, even if another thread replaces or removes it meanwhile. */
+    template<class F>
+    inline bool visit(std::string_view key, F f) {
+        return visit(key.data(), key.size(), hashKey(key.data(), key.size()), f);
+    }
+    template<class F>
+    inline bool visit(const HashedKey<Hash>& key, F f) {
+        return visit(key.key, key.length, hashKey(key), f);
+    }
+
+	/* Set the value for key, adding it if it doesn't exist. */
+    inline void set(std::string_view key, T value) {
+        put(key.data(), key.size(), hashKey(key.data(), key.size()), std::move(value), true);
+    }
+    inline void set(const HashedKey<Hash>& key, T value) {
+        put(key.key, key.length, hashKey(key), std::move(value), true);
+    }
+	/* Add key with value if it isn't set yet. Returns false, leaving the existing value, if it was. */
+    inline bool insert(std::string_view key, T value) {
+        return put(key.data(), key.size(), hashKey(key.data(), key.size()), std::move(value), false);
+    }
+    inline bool insert(const HashedKey<Hash>& key, T value) {
+        return put(key.key, key.length, hashKey(key), std::move(value), false);
+    }
+	/* Remove a key:value pair. Returns false if the key wasn't found. */
+    inline bool remove(std::string_view key) {
+        return erase(key.data(), key.size(), hashKey(key.data(), key.size()));
+    }
+    inline bool remove(const HashedKey<Hash>& key) {
+        return erase(key.key, key.length, hashKey(key));
+    }
+	/* Remove every key:value pair. */
+    void clear() {
+        for (Shard& s : shards) {
+            std::lock_guard<std::mutex> l(s.lock);
+            Table* t = s.table.load(std::memory_order_relaxed);
+            if (t == nullptr) {
+                continue;
+            }
+            s.table.store(nullptr, std::memory_order_seq_cst);
+            for (size_t i=0; i<t->capacity; i++) {
+                Node* e = t->slots[i].load(std::memory_order_relaxed);
+                if (e != nullptr && e != tombstone()) {
+                    retire(s, e);
+                }
+            }
+            retire(s, t);
+            s.count.store(0, std::memory_order_relaxed);
+            s.tombstones = 0;
+        }
+    }
+	/* Calls f(const char* key, const T& value) for every key:value pair, in no particular order.
+	   Pairs set or removed by other threads meanwhile may or may not be visited. */
+    template<class F>
+    void forEach(F f) {
+        EpochDomain::Guard g;
+        for (Shard& s : shards) {
+            Table* t = s.table.load(std::memory_order_acquire);
+            if (t == nullptr) {
+                continue;
+            }
+            for (size_t i=0; i<t->capacity; i++) {
+                Node* e = t->slots[i].load(std::memory_order_acquire);
+                if (e != nullptr && e != tombstone()) {
+                    f((const char*)e->key, (const T&)e->value);
+                }
+            }
+        }
+    }
+};
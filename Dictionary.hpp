@@ -1,27 +1,151 @@
 /* Simple string keyed dictionary class. Saves keys for later use, ideal for serialization/deserialization.
- * Relies on std::vector.hpp
+ * Entries are stored densely in insertion order, indexed by an open addressing hash table that grows to keep lookups O(1).
+ * Up to SMALL entries are stored inside the Dictionary itself and found by a linear scan, so small Dictionaries don't allocate.
+ * Slots are probed 16 at a time by comparing one control byte per slot, with SSE2 where available.
+ * Define DICTIONARY_SCALAR before including this file to force the portable probing code.
+ * Keys are hashed with WyHash by default, the Hash template parameter selects another policy.
+ * Keys may be given as C strings, std::string_views, or HashedKeys which carry a hash computed ahead of time.
+ * Dictionaries given a StringPool share one copy of each key with every other Dictionary using the pool.
+ * Keys the Dictionary copied to the heap are freed when they are removed, on clear() and when the Dictionary is destroyed.
  * Author: Adam "beckadamtheinventor" Beckingham
  * License: MIT
  */
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
+#include <exception>
 #include <string.h>
-#include <vector>
+#include <string_view>
+#include <utility>
 
-static size_t _hash(const char* s, size_t len=0) {
-        if (s == nullptr) {
-            return 0;
-        }
-        if (len == 0) {
-            len = strlen(s);
+#if !defined(DICTIONARY_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define DICTIONARY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "Arena.hpp"
+
+/* Hash policies for Dictionary. A policy has a static function
+     static constexpr size_t hash(const char* s, size_t len, uint64_t seed)
+   which must spread keys over all bits of the result, as Dictionary uses both the low and the high bits.
+   It only needs to be constexpr for HashedKeys to be hashed at compile time. */
+
+/* wyhash: reads keys 8 bytes at a time and mixes with 64x64->128-bit multiplies. The default. */
+class WyHash {
+    // replace a and b with the low and high halves of their 128-bit product
+    static constexpr void mum(uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+        unsigned __int128 r = (unsigned __int128)a * b;
+        a = (uint64_t)r;
+        b = (uint64_t)(r >> 64);
+#else
+        uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32);
+        uint64_t lo = t + (rm1 << 32);
+        b = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+        a = lo;
+#endif
+    }
+    static constexpr uint64_t mix(uint64_t a, uint64_t b) {
+        mum(a, b);
+        return a ^ b;
+    }
+    // little endian reads, built from bytes so they can run at compile time. Compilers merge them into single loads
+    static constexpr uint64_t r4(const char* p) {
+        return (uint64_t)(uint8_t)p[0] | (uint64_t)(uint8_t)p[1] << 8 | (uint64_t)(uint8_t)p[2] << 16 | (uint64_t)(uint8_t)p[3] << 24;
+    }
+    static constexpr uint64_t r8(const char* p) {
+        return r4(p) | r4(p + 4) << 32;
+    }
+    static constexpr uint64_t S0 = 0x2D358DCCAA6C78A5ULL;
+    static constexpr uint64_t S1 = 0x8BB84B93962EACC9ULL;
+    static constexpr uint64_t S2 = 0x4B33A62ED433D4A3ULL;
+    static constexpr uint64_t S3 = 0x4D5A2DA51DE1AA47ULL;
+
+    public:
+    static constexpr size_t hash(const char* s, size_t len, uint64_t seed) {
+        const char* p = s;
+        seed ^= mix(seed ^ S0, S1);
+        uint64_t a = 0, b = 0;
+        if (len <= 16) {
+            if (len >= 4) {
+                // two overlapping reads from each end cover every byte
+                a = (r4(p) << 32) | r4(p + ((len >> 3) << 2));
+                b = (r4(p + len - 4) << 32) | r4(p + len - 4 - ((len >> 3) << 2));
+            } else if (len > 0) {
+                a = ((uint64_t)(uint8_t)p[0] << 16) | ((uint64_t)(uint8_t)p[len >> 1] << 8) | (uint8_t)p[len - 1];
+            }
+        } else {
+            size_t i = len;
+            if (i > 48) {
+                uint64_t see1 = seed, see2 = seed;
+                do {
+                    seed = mix(r8(p) ^ S1, r8(p + 8) ^ seed);
+                    see1 = mix(r8(p + 16) ^ S2, r8(p + 24) ^ see1);
+                    see2 = mix(r8(p + 32) ^ S3, r8(p + 40) ^ see2);
+                    p += 48;
+                    i -= 48;
+                } while (i > 48);
+                seed ^= see1 ^ see2;
+            }
+            while (i > 16) {
+                seed = mix(r8(p) ^ S1, r8(p + 8) ^ seed);
+                p += 16;
+                i -= 16;
+            }
+            a = r8(p + i - 16);
+            b = r8(p + i - 8);
         }
-        size_t h = 0;
+        a ^= S1;
+        b ^= seed;
+        mum(a, b);
+        return (size_t)mix(a ^ S0 ^ len, b ^ S1);
+    }
+};
+
+/* FNV-1a, one byte at a time, followed by a 64-bit finalizer. Slower than WyHash on all but the shortest keys. */
+class FNVHash {
+    public:
+    static constexpr size_t hash(const char* s, size_t len, uint64_t seed) {
+        uint64_t h = 0xCBF29CE484222325ULL ^ seed;
         for (size_t i=0; i<len; i++) {
-            h = h*129 ^ s[i];
+            h = (h ^ (uint8_t)s[i]) * 0x100000001B3ULL;
         }
-        return h;
-}
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+        return (size_t)h;
+    }
+};
+
+/* A key together with its length and unseeded hash, computed once up front.
+   Lookups with a HashedKey skip strlen and hashing. A constexpr HashedKey is hashed at compile time:
+     static constexpr HashedKey<> NAME("name");
+     dict.get(NAME);
+   Hash must match the Dictionary's hash policy. The characters are not copied, so they must outlive the HashedKey. */
+template<class Hash=WyHash>
+class HashedKey {
+    public:
+    const char* key;
+    size_t length;
+    size_t hash;
+    constexpr explicit HashedKey(std::string_view key)
+        : key(key.data()), length(key.size()), hash(Hash::hash(key.data(), key.size(), 0)) {}
+    constexpr explicit HashedKey(const char* key) : HashedKey(std::string_view(key)) {}
+    /* hash must be the unseeded hash of the length characters at key. */
+    constexpr HashedKey(const char* key, size_t length, size_t hash) : key(key), length(length), hash(hash) {}
+    inline std::string_view view() const {
+        return std::string_view(key, length);
+    }
+};
+
+template<class Hash=WyHash>
+class StringPool;
+
 inline static char* _dupcstr(const char* str, size_t len=0) {
     if (len == 0) {
         len = strlen(str)+1;
@@ -31,94 +155,551 @@ inline static char* _dupcstr(const char* str, size_t len=0) {
     return s;
 }
 
-template<class T, size_t BUCKETS=64>
+template<class T, size_t MIN_CAPACITY=16, class Hash=WyHash, size_t SMALL=8>
 class Dictionary {
-    class Sym {
+    template<class> friend class StringPool;
+
+    public:
+    /* A key:value pair. Entries are kept in insertion order. */
+    class Entry {
         public:
         size_t hash;
         char* key;
+        // length of key, not counting the NUL terminator
+        size_t length;
+        // true if the Dictionary frees key, false if it is borrowed or belongs to an Arena or StringPool
+        bool owned;
         T value;
-        Sym() {
+        Entry() {
             hash = 0;
             key = nullptr;
+            length = 0;
+            owned = false;
             value = T();
         }
-        Sym(char *key) {
-            this->hash = _hash(key);
+        Entry(char *key, size_t length, size_t hash, bool owned) {
+            this->hash = hash;
             this->key = key;
+            this->length = length;
+            this->owned = owned;
             this->value = T();
         }
     };
 
+    /* Iterates over the entries in insertion order. */
+    class Iterator {
+        Entry* p;
+        Entry* end;
+        // step over the holes left by remove
+        inline void skip() {
+            while (p < end && p->key == nullptr) {
+                p++;
+            }
+        }
+        public:
+        Iterator(Entry* p, Entry* end) : p(p), end(end) {
+            skip();
+        }
+        inline Entry& operator*() {
+            return *p;
+        }
+        inline Entry* operator->() {
+            return p;
+        }
+        inline Iterator& operator++() {
+            p++;
+            skip();
+            return *this;
+        }
+        inline bool operator==(const Iterator& o) const {
+            return p == o.p;
+        }
+        inline bool operator!=(const Iterator& o) const {
+            return p != o.p;
+        }
+    };
+
+    private:
+    // control bytes: the low 7 bits of the hash for a full slot, or one of these
+    static const int8_t EMPTY = -128;
+    static const int8_t DELETED = -2;
+    // slots are probed in groups of this many
+    static const size_t GROUP = 16;
+
+    // bitmasks over the 16 control bytes of a group, bit n is set if byte n matches
+    static inline uint32_t match(const int8_t* ctrl, int8_t h2) {
+#ifdef DICTIONARY_SSE2
+        __m128i c = _mm_loadu_si128((const __m128i*)ctrl);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(h2)));
+#else
+        uint32_t m = 0;
+        for (size_t i=0; i<GROUP; i++) {
+            m |= (uint32_t)(ctrl[i] == h2) << i;
+        }
+        return m;
+#endif
+    }
+    static inline uint32_t matchEmpty(const int8_t* ctrl) {
+        return match(ctrl, EMPTY);
+    }
+    static inline uint32_t matchFree(const int8_t* ctrl) {
+#ifdef DICTIONARY_SSE2
+        // EMPTY and DELETED are the only negative control bytes
+        return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+        uint32_t m = 0;
+        for (size_t i=0; i<GROUP; i++) {
+            m |= (uint32_t)(ctrl[i] < 0) << i;
+        }
+        return m;
+#endif
+    }
+    static inline int ctz(uint32_t m) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz(m);
+#else
+        int n = 0;
+        while (!(m & 1)) {
+            m >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
+
     size_t len = 0;
-    Sym *lastaccess = nullptr;
-    std::vector<Sym>* buckets[BUCKETS] = {nullptr};
-
-    Sym* getsym(const char *key, bool create=true) {
-        size_t h = _hash(key);
-        if (lastaccess != nullptr && h == lastaccess->hash) {
-            if (!strcmp(key, lastaccess->key)) {
-                return lastaccess;
-            }
-        }
-        std::vector<Sym> *bucket = buckets[h % BUCKETS];
-        // printf("%llX\n", bucket);
-        // printf("Searching %llu items for key %s\n", bucket->length(), key);
-        for (size_t i=0; i<bucket->size(); i++) {
-            Sym *sym = &bucket->at(i);
-            if (h == sym->hash) {
-                if (!strcmp(key, sym->key)) {
-                    lastaccess = sym;
-                    return sym;
+    // entries in insertion order. Removed entries leave holes (a nullptr key) until the next compaction
+    Entry *entries = SMALL > 0 ? local : nullptr;
+    // number of entries used, including holes
+    size_t used = 0;
+    size_t allocated = SMALL;
+    // the hash index has a control byte and the number of an entry for each of its capacity slots.
+    // capacity is a power of two multiple of GROUP, or 0 while the entries are in local storage and there is no index
+    size_t capacity = 0;
+    // number of DELETED slots, which count towards the load factor until the next reindex
+    size_t deleted = 0;
+    int8_t *ctrl = nullptr;
+    size_t *index = nullptr;
+    Entry *lastaccess = nullptr;
+    Arena *arena = nullptr;
+    // mixed into every hash, so that which keys collide can't be predicted without it
+    uint64_t seed = 0;
+    // keys are taken from pool instead of being copied when it is set
+    StringPool<Hash> *pool = nullptr;
+    // the first SMALL entries live here, until the Dictionary outgrows it
+    Entry local[SMALL > 0 ? SMALL : 1];
+
+    // true while the entries are in local storage, where they are scanned instead of indexed
+    inline bool small() const {
+        return SMALL > 0 && entries == local;
+    }
+
+    inline size_t hashKey(const char* key, size_t n) {
+        return Hash::hash(key, n, seed);
+    }
+    // a HashedKey's hash is unseeded, so it can only be used as is by unseeded Dictionaries
+    inline size_t hashKey(const HashedKey<Hash>& key) {
+        return seed != 0 ? hashKey(key.key, key.length) : key.hash;
+    }
+
+    // interned keys are usually the same pointer, which skips comparing the characters
+    static inline bool matches(const Entry& e, const char* key, size_t n, size_t h) {
+        return e.hash == h && e.length == n && (key == e.key || !memcmp(key, e.key, n));
+    }
+
+    // slot of the index holding the n characters at key, or capacity if it isn't in the Dictionary
+    size_t lookup(const char* key, size_t n, size_t h) {
+        if (capacity == 0) {
+            return capacity;
+        }
+        size_t mask = capacity / GROUP - 1;
+        size_t g = (h >> 7) & mask;
+        int8_t h2 = h & 0x7F;
+        // triangular probing over groups visits every group once, since the number of groups is a power of two
+        for (size_t step=1; ; step++) {
+            const int8_t* c = &ctrl[g * GROUP];
+            for (uint32_t m = match(c, h2); m != 0; m &= m - 1) {
+                size_t i = g * GROUP + ctz(m);
+                if (matches(entries[index[i]], key, n, h)) {
+                    return i;
+                }
+            }
+            // probing for key would have stopped here when it was inserted
+            if (matchEmpty(c) != 0) {
+                return capacity;
+            }
+            g = (g + step) & mask;
+        }
+    }
+
+    // entry for the n characters at key, or nullptr if it isn't in the Dictionary
+    Entry* search(const char* key, size_t n, size_t h) {
+        if (small()) {
+            // comparing the hashes first makes a scan of a few entries cheaper than probing
+            for (size_t e=0; e<used; e++) {
+                if (entries[e].key != nullptr && matches(entries[e], key, n, h)) {
+                    return &entries[e];
+                }
+            }
+            return nullptr;
+        }
+        size_t i = lookup(key, n, h);
+        return i < capacity ? &entries[index[i]] : nullptr;
+    }
+
+    // first free slot on the probe sequence of hash h
+    size_t slot(size_t h) {
+        size_t mask = capacity / GROUP - 1;
+        size_t g = (h >> 7) & mask;
+        for (size_t step=1; ; step++) {
+            uint32_t m = matchFree(&ctrl[g * GROUP]);
+            if (m != 0) {
+                return g * GROUP + ctz(m);
+            }
+            g = (g + step) & mask;
+        }
+    }
+
+    // rebuild the index over the entries, sized for at least n+1 entries at under half load
+    void reindex(size_t n) {
+        size_t size = GROUP;
+        while (size < MIN_CAPACITY || (n + 1) * 16 > size * 7) {
+            size *= 2;
+        }
+        if (size != capacity) {
+            if (arena == nullptr && ctrl != nullptr) {
+                delete [] ctrl;
+                delete [] index;
+            }
+            ctrl = arena != nullptr ? (int8_t*)arena->alloc(size, 16) : new int8_t[size];
+            index = arena != nullptr ? (size_t*)arena->alloc(size * sizeof(size_t), alignof(size_t)) : new size_t[size];
+            capacity = size;
+        }
+        memset(ctrl, EMPTY, size);
+        deleted = 0;
+        for (size_t e=0; e<used; e++) {
+            if (entries[e].key != nullptr) {
+                size_t j = slot(entries[e].hash);
+                ctrl[j] = entries[e].hash & 0x7F;
+                index[j] = e;
+            }
+        }
+    }
+
+    // close the holes left by remove, keeping the entries in order. The index must be rebuilt afterwards
+    void compact() {
+        size_t n = 0;
+        for (size_t e=0; e<used; e++) {
+            if (entries[e].key != nullptr) {
+                if (n != e) {
+                    entries[n] = std::move(entries[e]);
                 }
+                n++;
             }
         }
-		if (create) {
-            bucket->push_back(Sym(_dupcstr(key)));
-			Sym *sym = &bucket->at(bucket->size()-1);
-			len++;
-			return sym;
-		}
-		return nullptr;
-    }
-    Sym* getsym(size_t i) {
-        if (i < len) {
-            for (size_t b = 0; b < BUCKETS; b++) {
-                size_t l = buckets[b]->size();
-                // printf("Bucket %llu length %llu index %llu\n", b, l, i);
-                if (i < l) {
-                    // printf("Found.\n");
-                    return &buckets[b]->at(i);
+        for (size_t e=n; e<used; e++) {
+            entries[e] = Entry();
+        }
+        used = n;
+        lastaccess = nullptr;
+    }
+
+    // move the entries to new storage for size entries, which must be at least used
+    void resize(size_t size) {
+        Entry* e = arena != nullptr ? arena->array<Entry>(size) : new Entry[size];
+        for (size_t i=0; i<used; i++) {
+            e[i] = std::move(entries[i]);
+        }
+        if (small()) {
+            for (size_t i=0; i<used; i++) {
+                local[i] = Entry();
+            }
+        } else if (arena == nullptr && entries != nullptr) {
+            delete [] entries;
+        }
+        entries = e;
+        allocated = size;
+        lastaccess = nullptr;
+    }
+
+    // smallest power of two number of entries, at least MIN_CAPACITY, that holds n
+    static inline size_t fit(size_t n) {
+        size_t size = MIN_CAPACITY < 1 ? 1 : MIN_CAPACITY;
+        while (size < n) {
+            size *= 2;
+        }
+        return size;
+    }
+
+    // move the entries back into local storage and drop the index. There must be no holes and at most SMALL entries
+    void unindex() {
+        for (size_t i=0; i<used; i++) {
+            local[i] = std::move(entries[i]);
+        }
+        if (arena == nullptr) {
+            delete [] entries;
+            delete [] ctrl;
+            delete [] index;
+        }
+        entries = local;
+        allocated = SMALL;
+        ctrl = nullptr;
+        index = nullptr;
+        capacity = 0;
+        deleted = 0;
+        lastaccess = nullptr;
+    }
+
+    Entry* insert(char* key, size_t n, size_t h, bool owned) {
+        if (used >= allocated) {
+            if (used > 0 && (used - len) * 4 >= used) {
+                // mostly holes, reuse the space instead of growing
+                compact();
+                if (!small()) {
+                    reindex(len);
                 }
-                i -= l;
+            } else {
+                resize(allocated < MIN_CAPACITY ? fit(MIN_CAPACITY) : allocated * 2);
             }
-            // printf("Not Found.\n");
+        }
+        size_t e = used++;
+        entries[e] = Entry(key, n, h, owned);
+        len++;
+        if (small()) {
+            return &entries[e];
+        }
+        // keep at least one slot in eight EMPTY, so every probe sequence ends.
+        // Leaving local storage also lands here, with no index yet
+        if ((len + deleted) * 8 > capacity * 7) {
+            reindex(len);
+            return &entries[e];
+        }
+        size_t j = slot(h);
+        if (ctrl[j] == DELETED) {
+            deleted--;
+        }
+        ctrl[j] = h & 0x7F;
+        index[j] = e;
+        return &entries[e];
+    }
+
+    // entry for the n characters at key with hash h, created if create is set.
+    // When copykey is not set, key must be NUL terminated at n
+    Entry* getsym(const char *key, size_t n, size_t h, bool create=true, bool copykey=true) {
+        if (lastaccess != nullptr && matches(*lastaccess, key, n, h)) {
+            return lastaccess;
+        }
+        Entry* found = search(key, n, h);
+        if (found != nullptr) {
+            lastaccess = found;
+            return found;
+        }
+        if (create) {
+            char *k = (char*)key;
+            bool owned = false;
+            if (copykey) {
+                if (pool != nullptr) {
+                    // pooled keys are hashed without the seed, so they can be shared
+                    k = (char*)pool->intern(HashedKey<Hash>(key, n, seed == 0 ? h : Hash::hash(key, n, 0))).key;
+                } else if (arena != nullptr) {
+                    k = arena->strdup(key, n);
+                } else {
+                    k = new char[n + 1];
+                    memcpy(k, key, n);
+                    k[n] = 0;
+                    owned = true;
+                }
+            }
+            return insert(k, n, h, owned);
         }
         return nullptr;
     }
+    inline Entry* getsym(const char *key, bool create=true, bool copykey=true) {
+        size_t n = strlen(key);
+        return getsym(key, n, hashKey(key, n), create, copykey);
+    }
+    Entry* getsym(size_t i) {
+        if (i >= len) {
+            return nullptr;
+        }
+        if (used != len) {
+            compact();
+            if (!small()) {
+                reindex(len);
+            }
+        }
+        return &entries[i];
+    }
+
+    bool remove(const char* key, size_t n, size_t h) {
+        Entry* e;
+        if (small()) {
+            e = search(key, n, h);
+            if (e == nullptr) {
+                return false;
+            }
+        } else {
+            size_t i = lookup(key, n, h);
+            if (i >= capacity) {
+                return false;
+            }
+            // a group with an EMPTY slot ends every probe sequence that reaches it, so no lookup needs to probe past this slot
+            size_t g = i & ~(GROUP - 1);
+            if (matchEmpty(&ctrl[g]) != 0) {
+                ctrl[i] = EMPTY;
+            } else {
+                ctrl[i] = DELETED;
+                deleted++;
+            }
+            e = &entries[index[i]];
+        }
+        // leave a hole so the other entries keep their places
+        if (e->owned) {
+            delete [] e->key;
+        }
+        *e = Entry();
+        len--;
+        lastaccess = nullptr;
+        // give memory back once most of it is unused. Arena memory can't be given back
+        if (arena == nullptr && !small() && allocated > fit(MIN_CAPACITY) && len * 4 < allocated) {
+            rehash();
+        }
+        return true;
+    }
+
+    // take o's storage, leaving it empty
+    void take(Dictionary& o) {
+        len = o.len;
+        if (o.small()) {
+            // local storage can't be taken, only its entries
+            for (size_t i=0; i<o.used; i++) {
+                local[i] = std::move(o.local[i]);
+                o.local[i] = Entry();
+            }
+            entries = local;
+        } else {
+            entries = o.entries;
+        }
+        used = o.used;
+        allocated = o.allocated;
+        capacity = o.capacity;
+        deleted = o.deleted;
+        ctrl = o.ctrl;
+        index = o.index;
+        arena = o.arena;
+        seed = o.seed;
+        pool = o.pool;
+        lastaccess = nullptr;
+        o.len = o.used = o.capacity = o.deleted = 0;
+        o.allocated = SMALL;
+        o.entries = SMALL > 0 ? o.local : nullptr;
+        o.ctrl = nullptr;
+        o.index = nullptr;
+        o.lastaccess = nullptr;
+    }
+
+    // add copies of o's key:value pairs. Borrowed keys stay borrowed
+    void copy(const Dictionary& o) {
+        reserve(len + o.len);
+        for (size_t e=0; e<o.used; e++) {
+            const Entry& src = o.entries[e];
+            if (src.key != nullptr) {
+                bool copykey = src.owned || o.arena != nullptr || o.pool != nullptr;
+                getsym(src.key, src.length, hashKey(src.key, src.length), true, copykey)->value = src.value;
+            }
+        }
+    }
 
     public:
 	/* Construct an empty Dictionary. */
-    Dictionary<T, BUCKETS>() {
+    Dictionary<T, MIN_CAPACITY, Hash, SMALL>() {
+        clear();
+    }
+	/* Construct an empty Dictionary that allocates its storage and keys from arena.
+	   Nothing is freed until the Arena is released. */
+    Dictionary<T, MIN_CAPACITY, Hash, SMALL>(Arena* arena) {
+        this->arena = arena;
         clear();
+    }
+	/* Construct an empty Dictionary that takes its keys from pool instead of copying them,
+	   allocating its storage from arena if given. The pool must outlive the Dictionary. */
+    Dictionary<T, MIN_CAPACITY, Hash, SMALL>(StringPool<Hash>* pool, Arena* arena=nullptr) {
+        this->pool = pool;
+        this->arena = arena;
+        clear();
+    }
+	/* Construct a deep copy of o, allocating from the same Arena and StringPool if it has them. */
+    Dictionary<T, MIN_CAPACITY, Hash, SMALL>(const Dictionary& o) {
+        arena = o.arena;
+        pool = o.pool;
+        seed = o.seed;
+        copy(o);
+    }
+	/* Take o's key:value pairs, leaving it empty. */
+    Dictionary<T, MIN_CAPACITY, Hash, SMALL>(Dictionary&& o) {
+        take(o);
+    }
+	/* Free every key:value pair. */
+    ~Dictionary<T, MIN_CAPACITY, Hash, SMALL>() {
+        clear();
+    }
+	/* Replace the contents with a deep copy of o. The Arena and StringPool are kept. */
+    Dictionary& operator=(const Dictionary& o) {
+        if (this != &o) {
+            clear();
+            seed = o.seed;
+            copy(o);
+        }
+        return *this;
+    }
+	/* Replace the contents with o's key:value pairs, leaving it empty. */
+    Dictionary& operator=(Dictionary&& o) {
+        if (this != &o) {
+            clear();
+            take(o);
+        }
+        return *this;
     }
 	/* Construct a Dictionary from existing keys and values. */
-    Dictionary<T, BUCKETS>(const char** keys, const T* values, size_t count) {
+    Dictionary<T, MIN_CAPACITY, Hash, SMALL>(const char** keys, const T* values, size_t count) {
         clear();
         for (size_t i=0; i<count; i++) {
             add(keys[i], values[i]);
         }
     }
-	/* Clear the Dictionary, removing all keys and values. */
+	/* Clear the Dictionary, removing all keys and values and freeing their storage. */
     void clear() {
-        this->len = 0;
-        this->lastaccess = nullptr;
-        for (size_t i=0; i<BUCKETS; i++) {
-            if (buckets[i] != nullptr) {
-                delete buckets[i];
+        for (size_t e=0; e<used; e++) {
+            if (entries[e].owned) {
+                delete [] entries[e].key;
             }
-            buckets[i] = new std::vector<Sym>();
         }
+        if (small()) {
+            for (size_t e=0; e<used; e++) {
+                entries[e] = Entry();
+            }
+        } else if (arena == nullptr) {
+            delete [] entries;
+            delete [] ctrl;
+            delete [] index;
+        }
+        this->len = 0;
+        this->used = 0;
+        this->deleted = 0;
+        this->lastaccess = nullptr;
+        entries = SMALL > 0 ? local : nullptr;
+        ctrl = nullptr;
+        index = nullptr;
+        allocated = SMALL;
+        capacity = 0;
+    }
+	/* Returns the Arena this Dictionary allocates from, or nullptr if it uses the heap. */
+    inline Arena* getArena() {
+        return arena;
+    }
+	/* Returns the StringPool keys are taken from, or nullptr if they are copied. */
+    inline StringPool<Hash>* getPool() {
+        return pool;
     }
 	/* Return the number of key:value pairs in the Dictionary. */
     inline size_t length() {
@@ -127,11 +708,80 @@ class Dictionary {
 	/* Returns true if the key is found in the Dictionary. */
     inline bool has(const char *key) {
         return getsym(key, false) != nullptr;
+    }
+    inline bool has(std::string_view key) {
+        return getsym(key.data(), key.size(), hashKey(key.data(), key.size()), false) != nullptr;
+    }
+    inline bool has(const HashedKey<Hash>& key) {
+        return getsym(key.key, key.length, hashKey(key), false) != nullptr;
+    }
+	/* Returns the unseeded hash of a key, for use with find(key, hash). */
+    static inline size_t hash(const char* key) {
+        return Hash::hash(key, strlen(key), 0);
+    }
+    static inline size_t hash(std::string_view key) {
+        return Hash::hash(key.data(), key.size(), 0);
+    }
+	/* Set the seed mixed into every hash, rehashing existing keys.
+	   A random seed, e.g. from std::random_device, stops crafted keys from all landing in the same slots. */
+    void setSeed(uint64_t seed) {
+        this->seed = seed;
+        for (size_t e=0; e<used; e++) {
+            if (entries[e].key != nullptr) {
+                entries[e].hash = hashKey(entries[e].key, entries[e].length);
+            }
+        }
+        lastaccess = nullptr;
+        if (capacity > 0) {
+            reindex(len);
+        }
+    }
+    inline uint64_t getSeed() {
+        return seed;
+    }
+	/* Returns a pointer to the value for key, or nullptr if it isn't in the Dictionary.
+	   Checking the result instead of calling has then get probes the Dictionary once.
+	   Never inserts or modifies anything, so it is safe to call concurrently with other lookups.
+	   hash must be the value returned by hash(key). It is only used by unseeded Dictionaries, seeded ones hash key again. */
+    T* find(std::string_view key, size_t hash) {
+        if (seed != 0) {
+            hash = hashKey(key.data(), key.size());
+        }
+        Entry* e = search(key.data(), key.size(), hash);
+        return e != nullptr ? &e->value : nullptr;
+    }
+    inline T* find(std::string_view key) {
+        return find(key, hashKey(key.data(), key.size()));
+    }
+    inline T* find(const char* key) {
+        return find(std::string_view(key));
+    }
+    inline T* find(const HashedKey<Hash>& key) {
+        return find(key.view(), key.hash);
     }
 	/* Get/Set a key:value pair in the Dictionary.
 	   key:value pair (default constructor for T value) is created if it doesn't exist. */
     inline T& get(const char* key) {
         return getsym(key)->value;
+    }
+    inline T& get(std::string_view key) {
+        return getsym(key.data(), key.size(), hashKey(key.data(), key.size()))->value;
+    }
+    inline T& get(const HashedKey<Hash>& key) {
+        return getsym(key.key, key.length, hashKey(key))->value;
+    }
+	/* Get/Set a key:value pair in the Dictionary without copying the key if it is created.
+	   The key must be NUL terminated and stay valid for as long as the Dictionary uses it,
+	   which a HashedKey made from a string literal always does. */
+    inline T& getBorrowed(const char* key) {
+        return getsym(key, true, false)->value;
+    }
+	/* length is the length of key, which may contain NUL characters. key[length] must be a NUL terminator. */
+    inline T& getBorrowed(const char* key, size_t length) {
+        return getsym(key, length, hashKey(key, length), true, false)->value;
+    }
+    inline T& getBorrowed(const HashedKey<Hash>& key) {
+        return getsym(key.key, key.length, hashKey(key), true, false)->value;
     }
 	/* Add a key:value pair to the Dictionary. */
     inline T& add(const char* key, const T value) {
@@ -141,39 +791,131 @@ class Dictionary {
 	/* Add a key:value pair to the Dictionary. */
     inline T& append(const char *key, const T value) {
         return add(key, value);
+    }
+	/* Remove a key:value pair from the Dictionary. Returns false if the key wasn't found. */
+    inline bool remove(const char* key) {
+        return remove(std::string_view(key));
+    }
+    inline bool remove(std::string_view key) {
+        return remove(key.data(), key.size(), hashKey(key.data(), key.size()));
+    }
+    inline bool remove(const HashedKey<Hash>& key) {
+        return remove(key.key, key.length, hashKey(key));
+    }
+	/* Make room for at least n key:value pairs, so adding up to n pairs doesn't reallocate or rebuild the index. */
+    void reserve(size_t n) {
+        if (n > allocated) {
+            resize(fit(n));
+        }
+        if (!small() && entries != nullptr && (capacity == 0 || (n + 1) * 16 > capacity * 7)) {
+            reindex(n);
+        }
+    }
+	/* Close the holes left by removed keys and shrink the storage and index to fit the current length,
+	   moving the entries back into the Dictionary itself if there are no more than SMALL.
+	   Called by remove once three quarters of the storage is unused. */
+    void rehash() {
+        if (len == 0) {
+            clear();
+            return;
+        }
+        if (used != len) {
+            compact();
+        }
+        if (len <= SMALL) {
+            if (!small()) {
+                unindex();
+            }
+            return;
+        }
+        if (fit(len) != allocated) {
+            resize(fit(len));
+        }
+        reindex(len);
     }
 	/* Return a value from the Dictionary given a key. */
     inline T& operator[](const char *key) {
         return get(key);
     }
-	/* Returns true if index is less than the number of key:value pairs.
-	   Note that the index of a given key:value pair will likely change when the Dictionary is modified. */
+    inline T& operator[](std::string_view key) {
+        return get(key);
+    }
+    inline T& operator[](const HashedKey<Hash>& key) {
+        return get(key);
+    }
+	/* Returns true if index is less than the number of key:value pairs. */
     inline bool has(size_t i) {
         return i < len;
     }
-	/* Get/Set key:value pair index in the Dictionary.
-	   Note that the index of a given key:value pair will likely change when the Dictionary is modified. */
-    inline T get(size_t i) {
-        Sym *sym = getsym(i);
-        if (sym == nullptr)
-            return T();
+	/* Get/Set key:value pair index in the Dictionary. Entries are indexed in insertion order.
+	   Returns a reference to the stored value, so nothing is copied. Throws if i is out of range.
+	   Note that removing a key:value pair shifts the index of every pair added after it. */
+    inline T& get(size_t i) {
+        Entry *sym = getsym(i);
+        if (sym == nullptr) {
+            printf("Dictionary index %llu out of range.\n", (unsigned long long)i);
+            throw std::exception();
+        }
         return sym->value;
     }
-	/* Return a value by index.
-	   Note that the index of a given key:value pair will likely change when the Dictionary is modified. */
-    inline T values(size_t i) {
-        Sym *sym = getsym(i);
-        if (sym == nullptr)
-            return T();
-        return sym->value;
+	/* Return a value by index, in insertion order. Same as get(i). */
+    inline T& values(size_t i) {
+        return get(i);
     }
-	/* Return a key by index.
-	   Note that the index of a given key:value pair will likely change when the Dictionary is modified. */
+	/* Return a key by index, in insertion order. */
     inline char* keys(size_t i) {
-        Sym *sym = getsym(i);
+        Entry *sym = getsym(i);
         if (sym == nullptr)
             return nullptr;
         return sym->key;
     }
+	/* Iterate over the entries in insertion order. Adding or removing keys invalidates iterators. */
+    inline Iterator begin() {
+        return Iterator(entries, entries + used);
+    }
+    inline Iterator end() {
+        return Iterator(entries + used, entries + used);
+    }
 
 };
+
+/* A pool of interned strings, each stored once along with its length and hash.
+ * Dictionaries constructed with a pool take their keys from it instead of copying them, so a key used by many Dictionaries
+ * (such as the field names of thousands of parsed JSON objects) is stored once, and is not hashed again when it is added.
+ * Lookups with the HashedKey returned by intern compare keys by pointer.
+ * Strings are kept until the pool is destroyed, so it must outlive every Dictionary using it. Not thread safe.
+ */
+template<class Hash>
+class StringPool {
+    // the value is unused
+    Dictionary<char, 64, Hash, 0> strings;
+
+    public:
+	/* Construct an empty pool that copies strings to the heap. */
+    StringPool() {}
+	/* Construct an empty pool that copies strings into arena. */
+    StringPool(Arena* arena) : strings(arena) {}
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+	/* Returns the pooled copy of key, adding it if it isn't in the pool yet.
+	   The result points into the pool and carries the key's length and unseeded hash. */
+    HashedKey<Hash> intern(const HashedKey<Hash>& key) {
+        auto* e = strings.getsym(key.key, key.length, key.hash);
+        return HashedKey<Hash>(e->key, e->length, e->hash);
+    }
+    inline HashedKey<Hash> intern(std::string_view key) {
+        return intern(HashedKey<Hash>(key));
+    }
+    inline HashedKey<Hash> intern(const char* key) {
+        return intern(HashedKey<Hash>(key));
+    }
+	/* Returns true if key has been interned. */
+    inline bool has(std::string_view key) {
+        return strings.has(key);
+    }
+	/* Returns the number of strings in the pool. */
+    inline size_t length() {
+        return strings.length();
+    }
+};
\ No newline at end of file
@@ -0,0 +1,630 @@
+/* Immutable string keyed dictionaries indexed by a minimal perfect hash.
+ * A FrozenDictionary is built once from a Dictionary, or from arrays of keys and values, and is then read only.
+ * Every key has a slot of its own, so a lookup is one hash, one compare and no probing.
+ * The whole table is one flat, relocatable blob which can be saved to a file and memory-mapped at the next startup.
+ * StaticFrozenDictionary builds the same kind of table at compile time from a literal key set.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  Dictionary<int> ids;
+ *  ids["stone"] = 1;
+ *  FrozenDictionary<int> frozen = freeze(ids);
+ *  const int* id = frozen.find("stone");
+ *  frozen.save("ids.bin");
+ *  FrozenDictionary<int> mapped = FrozenDictionary<int>::view(data, size); // data is the mapped file
+ *
+ *  static constexpr auto COLORS = makeFrozen<int>({{"red", 0xFF0000}, {"green", 0x00FF00}, {"blue", 0x0000FF}});
+ *  static_assert(*COLORS.find("green") == 0x00FF00);
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <string.h>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "Dictionary.hpp"
+
+/* The perfect hash shared by FrozenDictionary and StaticFrozenDictionary (hash and displace).
+   Keys are grouped into buckets of about four by their hash. Each bucket gets a pilot, the first value
+   that moves all of its keys into free slots, and a key's slot is found from its hash and its bucket's pilot. */
+namespace frozen {
+    /* Map x onto [0, n). */
+    static constexpr uint64_t reduce(uint64_t x, uint64_t n) {
+#ifdef __SIZEOF_INT128__
+        return (uint64_t)(((unsigned __int128)x * n) >> 64);
+#else
+        return x % n;
+#endif
+    }
+    static constexpr uint64_t position(uint64_t h, uint32_t pilot) {
+        uint64_t x = h ^ ((pilot + 1) * 0x9E3779B97F4A7C15ULL);
+        x ^= x >> 32;
+        x *= 0xD6E8FEB86659FD93ULL;
+        x ^= x >> 32;
+        return x;
+    }
+    /* Number of buckets for n keys. */
+    static constexpr uint64_t buckets(uint64_t n) {
+        return n < 4 ? 1 : (n + 3) / 4;
+    }
+    static constexpr uint64_t bucket(uint64_t h, uint64_t buckets) {
+        return reduce(h, buckets);
+    }
+    static constexpr uint64_t slot(uint64_t h, uint32_t pilot, uint64_t n) {
+        return reduce(position(h, pilot), n);
+    }
+
+    /* Find a pilot for each bucket so the n hashes land in distinct slots, writing the slot of key i to at[i].
+       order and taken have room for n values and start for buckets+1. Returns false if two hashes are equal. */
+    template<class Flag>
+    constexpr bool build(const uint64_t* hashes, uint64_t n, uint64_t buckets, uint32_t* pilots,
+                         uint64_t* at, uint64_t* order, uint64_t* start, Flag* taken) {
+        // group the keys by bucket, pilots counts the keys placed in each
+        for (uint64_t b=0; b<=buckets; b++) {
+            start[b] = 0;
+        }
+        for (uint64_t i=0; i<n; i++) {
+            start[bucket(hashes[i], buckets) + 1]++;
+        }
+        uint64_t largest = 0;
+        for (uint64_t b=0; b<buckets; b++) {
+            pilots[b] = 0;
+            if (start[b + 1] > largest) {
+                largest = start[b + 1];
+            }
+            start[b + 1] += start[b];
+        }
+        for (uint64_t i=0; i<n; i++) {
+            uint64_t b = bucket(hashes[i], buckets);
+            order[start[b] + pilots[b]++] = i;
+        }
+        for (uint64_t s=0; s<n; s++) {
+            taken[s] = false;
+        }
+        // place the largest buckets first, while most slots are still free
+        for (uint64_t size=largest; size>0; size--) {
+            for (uint64_t b=0; b<buckets; b++) {
+                uint64_t first = start[b], last = start[b + 1];
+                if (last - first != size) {
+                    continue;
+                }
+                // no pilot separates keys with equal hashes
+                for (uint64_t j=first; j<last; j++) {
+                    for (uint64_t k=j+1; k<last; k++) {
+                        if (hashes[order[j]] == hashes[order[k]]) {
+                            return false;
+                        }
+                    }
+                }
+                uint32_t pilot = 0;
+                while (true) {
+                    uint64_t k = first;
+                    for (; k<last; k++) {
+                        uint64_t s = slot(hashes[order[k]], pilot, n);
+                        if (taken[s]) {
+                            break;
+                        }
+                        taken[s] = true;
+                        at[order[k]] = s;
+                    }
+                    if (k == last) {
+                        break;
+                    }
+                    for (uint64_t u=first; u<k; u++) {
+                        taken[at[order[u]]] = false;
+                    }
+                    if (pilot == UINT32_MAX) {
+                        return false;
+                    }
+                    pilot++;
+                }
+                pilots[b] = pilot;
+            }
+        }
+        for (uint64_t b=0; b<buckets; b++) {
+            if (start[b] == start[b + 1]) {
+                pilots[b] = 0;
+            }
+        }
+        return true;
+    }
+
+    /* Seed for the next build attempt, after the hashes with seed collided. */
+    static constexpr uint64_t reseed(uint64_t seed) {
+        return (seed + 1) * 0x9E3779B97F4A7C15ULL;
+    }
+    static constexpr unsigned ATTEMPTS = 8;
+}
+
+/* A read only dictionary indexed by a minimal perfect hash, stored as one flat blob:
+     header | pilots (uint32_t per bucket) | slots (hash, key offset, key length, value) | keys (NUL terminated)
+   Offsets are relative to the blob, so it may be written to a file and mapped or read back anywhere.
+   A saved blob can only be read with the same T, Hash and byte order, which view() and load() check.
+   Values are constructed in place. Only trivially copyable values may be saved, loaded or viewed. */
+template<class T, class Hash=WyHash>
+class FrozenDictionary {
+    public:
+    class Slot {
+        public:
+        uint64_t hash;
+        // offset of the key from the start of the key strings
+        uint64_t key;
+        // length of key, not counting the NUL terminator
+        uint64_t length;
+        T value;
+    };
+    static_assert(alignof(Slot) <= alignof(std::max_align_t), "FrozenDictionary values must not be over-aligned");
+
+    private:
+    class Header {
+        public:
+        char magic[8];
+        // 0x01020304, to detect blobs written with the other byte order
+        uint32_t order;
+        // sizeof(T)
+        uint32_t valueSize;
+        uint64_t count;
+        uint64_t buckets;
+        uint64_t seed;
+        // hash of a fixed string, to detect blobs written with another hash policy
+        uint64_t check;
+        // size of the whole blob in bytes
+        uint64_t size;
+    };
+    static constexpr char MAGIC[8] = {'F', 'R', 'O', 'Z', 'E', 'N', 'D', '1'};
+
+    char* blob = nullptr;
+    size_t blobSize = 0;
+    // true if the blob was allocated by this FrozenDictionary
+    bool owned = false;
+    const uint32_t* pilots = nullptr;
+    Slot* slots = nullptr;
+    const char* strings = nullptr;
+    uint64_t count = 0;
+    uint64_t nbuckets = 0;
+    uint64_t seed = 0;
+
+    static inline uint64_t align(uint64_t x, uint64_t a) {
+        return (x + a - 1) & ~(a - 1);
+    }
+    static inline uint64_t pilotsOffset() {
+        return align(sizeof(Header), alignof(uint32_t));
+    }
+    static inline uint64_t slotsOffset(uint64_t buckets) {
+        return align(pilotsOffset() + buckets * sizeof(uint32_t), alignof(Slot));
+    }
+    static inline uint64_t stringsOffset(uint64_t count, uint64_t buckets) {
+        return slotsOffset(buckets) + count * sizeof(Slot);
+    }
+    static inline uint64_t checkHash() {
+        return (uint64_t)Hash::hash("FrozenDictionary", 16, 0);
+    }
+
+    // point the members into blob, which holds a complete table
+    void attach() {
+        const Header* header = (const Header*)blob;
+        count = header->count;
+        nbuckets = header->buckets;
+        seed = header->seed;
+        pilots = (const uint32_t*)(blob + pilotsOffset());
+        slots = (Slot*)(blob + slotsOffset(nbuckets));
+        strings = blob + stringsOffset(count, nbuckets);
+    }
+
+    void destroy() {
+        if (owned) {
+            if (!std::is_trivially_destructible<T>::value) {
+                for (uint64_t i=0; i<count; i++) {
+                    slots[i].value.~T();
+                }
+            }
+            free(blob);
+        }
+        blob = nullptr;
+        blobSize = 0;
+        owned = false;
+        pilots = nullptr;
+        slots = nullptr;
+        strings = nullptr;
+        count = nbuckets = seed = 0;
+    }
+
+    void take(FrozenDictionary& o) {
+        blob = o.blob;
+        blobSize = o.blobSize;
+        owned = o.owned;
+        pilots = o.pilots;
+        slots = o.slots;
+        strings = o.strings;
+        count = o.count;
+        nbuckets = o.nbuckets;
+        seed = o.seed;
+        o.blob = nullptr;
+        o.blobSize = 0;
+        o.owned = false;
+        o.pilots = nullptr;
+        o.slots = nullptr;
+        o.strings = nullptr;
+        o.count = o.nbuckets = o.seed = 0;
+    }
+
+    // build the table from n keys of the given lengths and pointers to their values
+    void build(uint64_t n, const char* const* keys, const uint64_t* lengths, const T* const* values) {
+        uint64_t buckets = n == 0 ? 0 : frozen::buckets(n);
+        std::vector<uint64_t> hashes(n), at(n), order(n), start(buckets + 1);
+        std::vector<uint32_t> table(buckets);
+        std::vector<unsigned char> taken(n);
+        uint64_t s = 0;
+        for (unsigned attempt=0; n>0; attempt++) {
+            for (uint64_t i=0; i<n; i++) {
+                hashes[i] = (uint64_t)Hash::hash(keys[i], lengths[i], s);
+            }
+            if (frozen::build(hashes.data(), n, buckets, table.data(), at.data(), order.data(), start.data(), taken.data())) {
+                break;
+            }
+            if (attempt + 1 == frozen::ATTEMPTS) {
+                printf("FrozenDictionary could not be built, are there duplicate keys?\n");
+                throw std::exception();
+            }
+            s = frozen::reseed(s);
+        }
+        uint64_t stringsSize = 0;
+        for (uint64_t i=0; i<n; i++) {
+            stringsSize += lengths[i] + 1;
+        }
+        uint64_t size = stringsOffset(n, buckets) + stringsSize;
+        blob = (char*)calloc(size, 1);
+        if (blob == nullptr) {
+            printf("FrozenDictionary out of memory\n");
+            throw std::exception();
+        }
+        blobSize = size;
+        owned = true;
+        Header* header = (Header*)blob;
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->order = 0x01020304;
+        header->valueSize = sizeof(T);
+        header->count = n;
+        header->buckets = buckets;
+        header->seed = s;
+        header->check = checkHash();
+        header->size = size;
+        if (buckets > 0) {
+            memcpy(blob + pilotsOffset(), table.data(), buckets * sizeof(uint32_t));
+        }
+        Slot* out = (Slot*)(blob + slotsOffset(buckets));
+        char* str = blob + stringsOffset(n, buckets);
+        uint64_t offset = 0;
+        for (uint64_t i=0; i<n; i++) {
+            Slot* e = &out[at[i]];
+            e->hash = hashes[i];
+            e->key = offset;
+            e->length = lengths[i];
+            memcpy(str + offset, keys[i], lengths[i]);
+            offset += lengths[i] + 1;
+        }
+        // count stays 0 until every value is constructed, so a throwing copy only frees the blob
+        for (uint64_t i=0; i<n; i++) {
+            try {
+                new (&out[at[i]].value) T(*values[i]);
+            } catch (...) {
+                for (uint64_t j=0; j<i; j++) {
+                    out[at[j]].value.~T();
+                }
+                free(blob);
+                blob = nullptr;
+                blobSize = 0;
+                owned = false;
+                throw;
+            }
+        }
+        attach();
+    }
+
+    inline const Slot* lookup(const char* key, uint64_t n, uint64_t h) const {
+        if (count == 0) {
+            return nullptr;
+        }
+        const Slot* e = &slots[frozen::slot(h, pilots[frozen::bucket(h, nbuckets)], count)];
+        if (e->hash == h && e->length == n && memcmp(strings + e->key, key, n) == 0) {
+            return e;
+        }
+        return nullptr;
+    }
+
+    public:
+    /* Construct an empty FrozenDictionary. */
+    FrozenDictionary() {}
+    /* Freeze the entries of a Dictionary. The keys and values are copied. */
+    template<size_t MIN_CAPACITY, class H, size_t SMALL>
+    FrozenDictionary(Dictionary<T, MIN_CAPACITY, H, SMALL>& dict) {
+        std::vector<const char*> keys;
+        std::vector<uint64_t> lengths;
+        std::vector<const T*> values;
+        keys.reserve(dict.length());
+        lengths.reserve(dict.length());
+        values.reserve(dict.length());
+        for (auto& e : dict) {
+            keys.push_back(e.key);
+            lengths.push_back(e.length);
+            values.push_back(&e.value);
+        }
+        build(keys.size(), keys.data(), lengths.data(), values.data());
+    }
+    /* Construct from count NUL terminated keys and their values. Keys must be unique. */
+    FrozenDictionary(const char* const* keys, const T* values, size_t count) {
+        std::vector<uint64_t> lengths(count);
+        std::vector<const T*> pointers(count);
+        for (size_t i=0; i<count; i++) {
+            lengths[i] = strlen(keys[i]);
+            pointers[i] = &values[i];
+        }
+        build(count, keys, lengths.data(), pointers.data());
+    }
+    FrozenDictionary(const FrozenDictionary&) = delete;
+    FrozenDictionary& operator=(const FrozenDictionary&) = delete;
+    FrozenDictionary(FrozenDictionary&& o) {
+        take(o);
+    }
+    FrozenDictionary& operator=(FrozenDictionary&& o) {
+        if (this != &o) {
+            destroy();
+            take(o);
+        }
+        return *this;
+    }
+    ~FrozenDictionary() {
+        destroy();
+    }
+
+    /* Return a FrozenDictionary reading the blob of size bytes at data, as returned by data() or written by save().
+       The blob is not copied and must stay valid, unchanged and aligned to 8 bytes while the FrozenDictionary is used.
+       Throws if the blob is invalid or was written with another value type, hash policy or byte order. */
+    static FrozenDictionary view(const void* data, size_t size) {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be read from a blob");
+        const char* p = (const char*)data;
+        const Header* header = (const Header*)p;
+        if (((uintptr_t)p & (alignof(Slot) - 1)) != 0) {
+            printf("FrozenDictionary blob is not aligned\n");
+            throw std::exception();
+        }
+        if (size < sizeof(Header) || memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+            printf("FrozenDictionary blob is invalid\n");
+            throw std::exception();
+        }
+        if (header->order != 0x01020304 || header->valueSize != sizeof(T) || header->check != checkHash()) {
+            printf("FrozenDictionary blob was written with another value type, hash or byte order\n");
+            throw std::exception();
+        }
+        uint64_t n = header->count;
+        if (header->size > size || header->buckets != (n == 0 ? 0 : frozen::buckets(n))
+            || n > size / sizeof(Slot) || stringsOffset(n, header->buckets) > header->size) {
+            printf("FrozenDictionary blob is truncated\n");
+            throw std::exception();
+        }
+        FrozenDictionary d;
+        d.blob = (char*)p;
+        d.blobSize = header->size;
+        d.attach();
+        // keys must lie inside the blob, so a bad blob can't make lookups read past it
+        uint64_t stringsSize = header->size - stringsOffset(n, header->buckets);
+        for (uint64_t i=0; i<n; i++) {
+            const Slot& e = d.slots[i];
+            if (e.key >= stringsSize || e.length >= stringsSize - e.key || d.strings[e.key + e.length] != 0) {
+                printf("FrozenDictionary blob is invalid\n");
+                throw std::exception();
+            }
+        }
+        return d;
+    }
+    /* Read a blob written by save() into memory. Throws if the file can't be read or is invalid. */
+    static FrozenDictionary load(const char* path) {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be read from a blob");
+        FILE* fd = fopen(path, "rb");
+        if (fd == nullptr) {
+            printf("FrozenDictionary could not open \"%s\"\n", path);
+            throw std::exception();
+        }
+        fseek(fd, 0, SEEK_END);
+        long size = ftell(fd);
+        fseek(fd, 0, SEEK_SET);
+        char* buf = size > 0 ? (char*)malloc(size) : nullptr;
+        if (buf == nullptr || fread(buf, 1, size, fd) != (size_t)size) {
+            free(buf);
+            fclose(fd);
+            printf("FrozenDictionary could not read \"%s\"\n", path);
+            throw std::exception();
+        }
+        fclose(fd);
+        FrozenDictionary d;
+        try {
+            d = view(buf, size);
+        } catch (...) {
+            free(buf);
+            throw;
+        }
+        d.owned = true;
+        return d;
+    }
+    /* Write the blob to a file. Returns false on failure. */
+    bool save(const char* path) const {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be saved");
+        FILE* fd = fopen(path, "wb");
+        if (fd == nullptr) {
+            return false;
+        }
+        bool ok = fwrite(blob, 1, blobSize, fd) == blobSize;
+        return fclose(fd) == 0 && ok;
+    }
+    /* Return the blob holding the table. */
+    inline const void* data() const {
+        return blob;
+    }
+    /* Return the size of the blob in bytes. */
+    inline size_t size() const {
+        return blobSize;
+    }
+
+    /* Return the number of keys. */
+    inline size_t length() const {
+        return count;
+    }
+    /* Return a pointer to the value of key, or nullptr if it is not in the FrozenDictionary. */
+    inline const T* find(const char* key, size_t n) const {
+        const Slot* e = lookup(key, n, (uint64_t)Hash::hash(key, n, seed));
+        return e == nullptr ? nullptr : &e->value;
+    }
+    inline const T* find(const char* key) const {
+        return find(key, strlen(key));
+    }
+    inline const T* find(std::string_view key) const {
+        return find(key.data(), key.size());
+    }
+    /* The precomputed hash is used unless the table had to be built with a seed. */
+    inline const T* find(const HashedKey<Hash>& key) const {
+        uint64_t h = seed == 0 ? (uint64_t)key.hash : (uint64_t)Hash::hash(key.key, key.length, seed);
+        const Slot* e = lookup(key.key, key.length, h);
+        return e == nullptr ? nullptr : &e->value;
+    }
+    inline bool has(const char* key) const {
+        return find(key) != nullptr;
+    }
+    inline bool has(std::string_view key) const {
+        return find(key) != nullptr;
+    }
+    inline bool has(const HashedKey<Hash>& key) const {
+        return find(key) != nullptr;
+    }
+    /* Return the value of key, or def if it is not in the FrozenDictionary. */
+    inline T get(std::string_view key, T def=T()) const {
+        const T* v = find(key);
+        return v == nullptr ? def : *v;
+    }
+    inline T get(const HashedKey<Hash>& key, T def=T()) const {
+        const T* v = find(key);
+        return v == nullptr ? def : *v;
+    }
+    /* Return a key by slot index. Slots are in hash order, not insertion order. */
+    inline const char* keys(size_t i) const {
+        return i < count ? strings + slots[i].key : nullptr;
+    }
+    /* Return a value by slot index. */
+    inline const T& values(size_t i) const {
+        return slots[i].value;
+    }
+};
+
+/* Freeze the entries of a Dictionary into a FrozenDictionary. The Dictionary is left unchanged. */
+template<class T, size_t MIN_CAPACITY, class Hash, size_t SMALL>
+inline FrozenDictionary<T, Hash> freeze(Dictionary<T, MIN_CAPACITY, Hash, SMALL>& dict) {
+    return FrozenDictionary<T, Hash>(dict);
+}
+
+/* A key:value pair for makeFrozen. */
+template<class T>
+class FrozenItem {
+    public:
+    const char* key;
+    T value;
+};
+
+/* A FrozenDictionary of N literal keys, built at compile time. T must be a literal type.
+   The keys are not copied, so they should be string literals. Lookups may be constant expressions. */
+template<class T, size_t N, class Hash=WyHash>
+class StaticFrozenDictionary {
+    static_assert(N > 0, "StaticFrozenDictionary needs at least one key");
+    public:
+    static constexpr uint64_t BUCKETS = frozen::buckets(N);
+    class Slot {
+        public:
+        const char* key = nullptr;
+        size_t length = 0;
+        uint64_t hash = 0;
+        T value = T();
+    };
+
+    private:
+    Slot slots[N] = {};
+    uint32_t pilots[BUCKETS] = {};
+    uint64_t seed = 0;
+
+    public:
+    constexpr StaticFrozenDictionary(const FrozenItem<T> (&items)[N]) {
+        uint64_t hashes[N] = {};
+        uint64_t at[N] = {};
+        uint64_t order[N] = {};
+        uint64_t start[BUCKETS + 1] = {};
+        bool taken[N] = {};
+        for (unsigned attempt=0; ; attempt++) {
+            for (size_t i=0; i<N; i++) {
+                hashes[i] = (uint64_t)Hash::hash(items[i].key, std::string_view(items[i].key).size(), seed);
+            }
+            if (frozen::build(hashes, N, BUCKETS, pilots, at, order, start, taken)) {
+                break;
+            }
+            if (attempt + 1 == frozen::ATTEMPTS) {
+                // duplicate keys, fails to compile when evaluated at compile time
+                throw std::exception();
+            }
+            seed = frozen::reseed(seed);
+        }
+        for (size_t i=0; i<N; i++) {
+            Slot& e = slots[at[i]];
+            e.key = items[i].key;
+            e.length = std::string_view(items[i].key).size();
+            e.hash = hashes[i];
+            e.value = items[i].value;
+        }
+    }
+
+    /* Return the number of keys. */
+    constexpr size_t length() const {
+        return N;
+    }
+    /* Return a pointer to the value of key, or nullptr if it is not in the StaticFrozenDictionary. */
+    constexpr const T* find(std::string_view key) const {
+        uint64_t h = (uint64_t)Hash::hash(key.data(), key.size(), seed);
+        const Slot& e = slots[frozen::slot(h, pilots[frozen::bucket(h, BUCKETS)], N)];
+        if (e.hash == h && std::string_view(e.key, e.length) == key) {
+            return &e.value;
+        }
+        return nullptr;
+    }
+    constexpr const T* find(const HashedKey<Hash>& key) const {
+        uint64_t h = seed == 0 ? (uint64_t)key.hash : (uint64_t)Hash::hash(key.key, key.length, seed);
+        const Slot& e = slots[frozen::slot(h, pilots[frozen::bucket(h, BUCKETS)], N)];
+        if (e.hash == h && std::string_view(e.key, e.length) == std::string_view(key.key, key.length)) {
+            return &e.value;
+        }
+        return nullptr;
+    }
+    constexpr bool has(std::string_view key) const {
+        return find(key) != nullptr;
+    }
+    /* Return the value of key, or def if it is not in the StaticFrozenDictionary. */
+    constexpr T get(std::string_view key, T def=T()) const {
+        const T* v = find(key);
+        return v == nullptr ? def : *v;
+    }
+    /* Return a key by slot index. */
+    constexpr const char* keys(size_t i) const {
+        return slots[i].key;
+    }
+    /* Return a value by slot index. */
+    constexpr const T& values(size_t i) const {
+        return slots[i].value;
+    }
+};
+
+/* Build a StaticFrozenDictionary from a braced list of {key, value} pairs:
+     static constexpr auto IDS = makeFrozen<int>({{"a", 1}, {"b", 2}}); */
+template<class T, class Hash=WyHash, size_t N>
+constexpr StaticFrozenDictionary<T, N, Hash> makeFrozen(const FrozenItem<T> (&items)[N]) {
+    return StaticFrozenDictionary<T, N, Hash>(items);
+}
@@ -3,15 +3,29 @@
  * License: MIT
  * Usage:
  *  JSON::JSON json = JSON::JSON::deserialize(filedata);
- *  char* serialized = json.serialize();
+ *  const char* serialized = json.serialize();
+ *  free((void*)serialized);
  */
 #pragma once
 
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "Arena.hpp"
 #include "Dictionary.hpp"
+#include "JsonScan.hpp"
+#include "NumberParse.hpp"
 
 #define JSONMap Dictionary<JSON>
 
@@ -33,28 +47,452 @@ namespace JSON {
         User = 0x100,
     };
 
-    static char* dupcstr(std::string s) {
-        char* r = (char*) malloc(s.length()+1);
+    static char* dupcstr(const char* s, jsize_t len) {
+        char* r = (char*) malloc(len+1);
         if (r == NULL) {
             printf("JSON::dupcstr() out of memory");
             throw std::exception();
         }
-        size_t i;
-        for (i=0; i<s.length(); i++) {
-            r[i] = s[i];
-        }
-        r[i] = 0;
+        memcpy(r, s, len);
+        r[len] = 0;
         return r;
     }
+    static char* dupcstr(const std::string& s) {
+        return dupcstr(s.c_str(), s.length());
+    }
+
+    /* Thrown by the parser when the input is not valid JSON.
+     * offset is the byte offset of the error, line and column are 1-based. */
+    class ParseError : public std::exception {
+        public:
+        jsize_t offset;
+        jsize_t line;
+        jsize_t column;
+        // the error without its position, for callers that report the position themselves
+        char reason[96];
+        char message[192];
+        ParseError(const char* data, jsize_t offset, const char* msg) {
+            this->offset = offset;
+            line = 1;
+            column = 1;
+            // only walked on failure, so the tokenizer never has to track lines itself
+            for (jsize_t i=0; i<offset; i++) {
+                if (data[i] == '\n') {
+                    line++;
+                    column = 1;
+                } else {
+                    column++;
+                }
+            }
+            format(msg);
+        }
+        /* Construct a ParseError from a position tracked by the caller, for input that is no longer in memory. */
+        ParseError(jsize_t offset, jsize_t line, jsize_t column, const char* msg) {
+            this->offset = offset;
+            this->line = line;
+            this->column = column;
+            format(msg);
+        }
+        /* Construct a ParseError for binary input, which has no lines. */
+        ParseError(jsize_t offset, const char* msg) {
+            this->offset = offset;
+            line = column = 0;
+            snprintf(reason, sizeof(reason), "%s", msg);
+            snprintf(message, sizeof(message), "parse error at offset %llu: %s", (unsigned long long)offset, msg);
+        }
+        void format(const char* msg) {
+            snprintf(reason, sizeof(reason), "%s", msg);
+            snprintf(message, sizeof(message), "JSON parse error at line %llu column %llu (offset %llu): %s",
+                (unsigned long long)line, (unsigned long long)column, (unsigned long long)offset, msg);
+        }
+        const char* what() const noexcept override {
+            return message;
+        }
+    };
+
+    /* Single-pass JSON tokenizer.
+     * Every input byte is read exactly once; numbers are accumulated as they are scanned
+     * and string runs without escapes are found with the SIMD kernels in JsonScan.hpp and appended in bulk.
+     * Extensions over strict JSON (for compatibility with older files): hex integers (0x1F), \x and \0 escapes.
+     */
+    class Tokenizer {
+        public:
+        enum Token {
+            End = 0,
+            BeginObject,
+            EndObject,
+            BeginArray,
+            EndArray,
+            Colon,
+            Comma,
+            String,
+            Integer,
+            Float,
+            True,
+            False,
+            Null,
+        };
+        const char* begin;
+        const char* ptr;
+        const char* end;
+        // start of the most recently returned token
+        const char* start;
+        // decoded value of the most recent String/Integer/Float token.
+        // s is NUL-terminated and valid until the next String token.
+        const char* s;
+        jsize_t slen;
+        jlong_t i;
+        jdouble_t d;
+        // strings are decoded in place, s points into the input buffer
+        bool insitu;
+        const scan::Kernels& kernels;
+
+        Tokenizer(const char* data, jsize_t len) : kernels(scan::kernels()) {
+            begin = ptr = start = data;
+            end = data + len;
+            s = "";
+            slen = 0;
+            i = 0;
+            d = 0;
+            insitu = false;
+        }
+        /* Construct a Tokenizer that decodes strings in place when insitu is true.
+           Each string is unescaped over itself and NUL-terminated, so data is modified. */
+        Tokenizer(char* data, jsize_t len, bool insitu) : Tokenizer(data, len) {
+            this->insitu = insitu;
+        }
+
+        /* Byte offset of the read position. */
+        inline jsize_t tell() {
+            return ptr - begin;
+        }
+
+        /* Throw a ParseError pointing at the start of the current token. */
+        [[noreturn]] void error(const char* msg) {
+            error(msg, start);
+        }
+        [[noreturn]] void error(const char* msg, const char* at) {
+            throw ParseError(begin, at - begin, msg);
+        }
+
+        inline void skipspace() {
+            // minified input rarely has whitespace, so check one byte before calling the kernel
+            if (ptr < end && scan::isspace(*ptr)) {
+                ptr = kernels.space(ptr + 1, end);
+            }
+        }
+
+        /* Read the next token. Returns End at the end of input. */
+        Token next() {
+            skipspace();
+            start = ptr;
+            if (ptr >= end) {
+                return End;
+            }
+            char c = *ptr++;
+            switch (c) {
+                case '{':
+                    return BeginObject;
+                case '}':
+                    return EndObject;
+                case '[':
+                    return BeginArray;
+                case ']':
+                    return EndArray;
+                case ':':
+                    return Colon;
+                case ',':
+                    return Comma;
+                case '"':
+                    readString();
+                    return String;
+                case 't':
+                    literal("rue", 3);
+                    return True;
+                case 'f':
+                    literal("alse", 4);
+                    return False;
+                case 'n':
+                    literal("ull", 3);
+                    return Null;
+                case '-':
+                case '0': case '1': case '2': case '3': case '4':
+                case '5': case '6': case '7': case '8': case '9':
+                    return readNumber(c);
+                default:
+                    error("unexpected character");
+            }
+        }
+
+        private:
+        std::string str;
+
+        static char nibble(char c) {
+            if (c >= '0' && c <= '9') {
+                return c - '0';
+            } else if (c >= 'A' && c <= 'F') {
+                return c + 10 - 'A';
+            } else if (c >= 'a' && c <= 'f') {
+                return c + 10 - 'a';
+            }
+            return -1;
+        }
+
+        void literal(const char* rest, jsize_t len) {
+            if ((jsize_t)(end - ptr) < len || memcmp(ptr, rest, len)) {
+                error("invalid literal");
+            }
+            ptr += len;
+        }
+
+        unsigned int readHex(int digits) {
+            unsigned int v = 0;
+            for (int k=0; k<digits; k++) {
+                char n = ptr < end ? nibble(*ptr) : -1;
+                if (n < 0) {
+                    error("invalid hex escape", ptr);
+                }
+                v = (v << 4) | n;
+                ptr++;
+            }
+            return v;
+        }
+
+        static int encodeUtf8(unsigned int cp, char* out) {
+            if (cp < 0x80) {
+                out[0] = (char)cp;
+                return 1;
+            } else if (cp < 0x800) {
+                out[0] = (char)(0xC0 | (cp >> 6));
+                out[1] = (char)(0x80 | (cp & 0x3F));
+                return 2;
+            } else if (cp < 0x10000) {
+                out[0] = (char)(0xE0 | (cp >> 12));
+                out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                out[2] = (char)(0x80 | (cp & 0x3F));
+                return 3;
+            }
+            out[0] = (char)(0xF0 | (cp >> 18));
+            out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+            out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+            out[3] = (char)(0x80 | (cp & 0x3F));
+            return 4;
+        }
+
+        /* Decode the escape sequence following a backslash into out, returning the number of bytes written.
+           The output is never longer than the escape sequence, which is what makes in-situ decoding safe. */
+        int readEscape(char* out) {
+            if (ptr >= end) {
+                error("unterminated string");
+            }
+            char c = *ptr++;
+            switch (c) {
+                case '"': out[0] = '"'; return 1;
+                case '\\': out[0] = '\\'; return 1;
+                case '/': out[0] = '/'; return 1;
+                case 'b': out[0] = '\b'; return 1;
+                case 'f': out[0] = '\f'; return 1;
+                case 'n': out[0] = '\n'; return 1;
+                case 'r': out[0] = '\r'; return 1;
+                case 't': out[0] = '\t'; return 1;
+                case '0': out[0] = '\0'; return 1;
+                case 'x': out[0] = (char)readHex(2); return 1;
+                case 'u': {
+                    unsigned int cp = readHex(4);
+                    if (cp >= 0xD800 && cp < 0xDC00) {
+                        if (end - ptr < 6 || ptr[0] != '\\' || ptr[1] != 'u') {
+                            error("unpaired surrogate in \\u escape", ptr);
+                        }
+                        ptr += 2;
+                        unsigned int lo = readHex(4);
+                        if (lo < 0xDC00 || lo >= 0xE000) {
+                            error("invalid low surrogate in \\u escape", ptr - 6);
+                        }
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    }
+                    return encodeUtf8(cp, out);
+                }
+                default:
+                    error("invalid escape sequence", ptr - 2);
+            }
+        }
+
+        void readString() {
+            if (insitu) {
+                readStringInSitu();
+                return;
+            }
+            str.clear();
+            while (true) {
+                const char* run = ptr;
+                ptr = kernels.string(ptr, end);
+                str.append(run, ptr - run);
+                if (ptr >= end) {
+                    error("unterminated string");
+                }
+                char c = *ptr++;
+                if (c == '"') {
+                    break;
+                }
+                if (c != '\\') {
+                    error("control character in string", ptr - 1);
+                }
+                char buf[4];
+                str.append(buf, readEscape(buf));
+            }
+            s = str.c_str();
+            slen = str.length();
+        }
+
+        // unescape the string over itself and replace the closing quote with a NUL terminator
+        void readStringInSitu() {
+            char* dst = (char*)ptr;
+            s = dst;
+            while (true) {
+                const char* run = ptr;
+                ptr = kernels.string(ptr, end);
+                if (dst != run) {
+                    memmove(dst, run, ptr - run);
+                }
+                dst += ptr - run;
+                if (ptr >= end) {
+                    error("unterminated string");
+                }
+                char c = *ptr++;
+                if (c == '"') {
+                    break;
+                }
+                if (c != '\\') {
+                    error("control character in string", ptr - 1);
+                }
+                dst += readEscape(dst);
+            }
+            *dst = 0;
+            slen = dst - s;
+        }
+
+        Token readNumber(char c) {
+            bool neg = false;
+            if (c == '-') {
+                neg = true;
+                if (ptr >= end || *ptr < '0' || *ptr > '9') {
+                    error("expected digit after '-'");
+                }
+                c = *ptr++;
+            }
+            if (c == '0' && ptr < end && (*ptr == 'x' || *ptr == 'X')) {
+                ptr++;
+                unsigned long long num = 0;
+                const char* digits = ptr;
+                char n;
+                while (ptr < end && (n = nibble(*ptr)) >= 0) {
+                    num = (num << 4) | n;
+                    ptr++;
+                }
+                if (ptr == digits || ptr - digits > 16) {
+                    error("invalid hex number");
+                }
+                i = neg ? -(jlong_t)num : (jlong_t)num;
+                return Integer;
+            }
+            // mantissa digits are accumulated while scanning; exp10 is the decimal exponent applied to them
+            unsigned long long mant = c - '0';
+            long exp10 = 0;
+            bool full = false;
+            bool truncated = false;
+            bool flt = false;
+            if (c != '0') {
+                while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+                    if (!full && NumberParse::fits(mant, *ptr)) {
+                        mant = mant * 10 + (*ptr - '0');
+                    } else {
+                        full = true;
+                        truncated |= *ptr != '0';
+                        exp10++;
+                    }
+                    ptr++;
+                }
+            } else if (ptr < end && *ptr >= '0' && *ptr <= '9') {
+                error("leading zeros are not allowed");
+            }
+            if (ptr < end && *ptr == '.') {
+                ptr++;
+                flt = true;
+                const char* digits = ptr;
+                while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+                    if (!full && NumberParse::fits(mant, *ptr)) {
+                        mant = mant * 10 + (*ptr - '0');
+                        exp10--;
+                    } else {
+                        full = true;
+                        truncated |= *ptr != '0';
+                    }
+                    ptr++;
+                }
+                if (ptr == digits) {
+                    error("expected digit after '.'", ptr);
+                }
+            }
+            if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+                ptr++;
+                flt = true;
+                bool eneg = false;
+                if (ptr < end && (*ptr == '+' || *ptr == '-')) {
+                    eneg = *ptr++ == '-';
+                }
+                const char* digits = ptr;
+                long e = 0;
+                while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+                    if (e < 100000) {
+                        e = e * 10 + (*ptr - '0');
+                    }
+                    ptr++;
+                }
+                if (ptr == digits) {
+                    error("expected digit in exponent", ptr);
+                }
+                exp10 += eneg ? -e : e;
+            }
+            if (!flt && exp10 == 0) {
+                if (mant <= (unsigned long long)INT64_MAX) {
+                    i = neg ? -(jlong_t)mant : (jlong_t)mant;
+                    return Integer;
+                } else if (neg && mant == (unsigned long long)INT64_MAX + 1) {
+                    i = INT64_MIN;
+                    return Integer;
+                }
+                // out of integer range, fall through to float
+            }
+            if (NumberParse::toDouble(mant, exp10, neg, truncated, start, ptr - start, d) != NumberParse::Ok) {
+                error("number out of range");
+            }
+            return Float;
+        }
+    };
+
+    class Writer;
 
     class JSON {
         public:
         class JSONArray {
             static const jsize_t MIN_ALLOC = 10;
+            // capacity to grow to so that at least size members fit, doubling to keep appends amortized O(1)
+            inline jsize_t grown(jsize_t size) {
+                jsize_t n = allocated < MIN_ALLOC ? MIN_ALLOC : allocated * 2;
+                return n < size ? size : n;
+            }
+            // members of an arena array are never destroyed, so a value that owns its storage is copied into the arena
+            inline void adopt(JSON& object) {
+                if (arena != nullptr && object.isOwned()) {
+                    object = object.clone(arena);
+                }
+            }
             public:
             jsize_t length;
             jsize_t allocated;
             JSON *members;
+            // when set, members are allocated from here and never freed individually
+            Arena *arena = nullptr;
             JSONArray() : JSONArray(MIN_ALLOC) {}
             JSONArray(jsize_t size) {
                 allocated = size;
@@ -66,14 +504,24 @@ namespace JSON {
                 this->length = size;
                 this->members = members;
             }
-            JSONArray(JSONArray& a) : JSONArray(a.length) {
+            /* Construct an empty array with room for size members allocated from arena. */
+            JSONArray(Arena* arena, jsize_t size) {
+                this->arena = arena;
+                allocated = size;
+                length = 0;
+                members = size > 0 ? arena->array<JSON>(size) : nullptr;
+            }
+            /* Copy an array. Members that own their values are deep copied. */
+            JSONArray(const JSONArray& a) : JSONArray(a.length < MIN_ALLOC ? MIN_ALLOC : a.length) {
                 for (jsize_t i=0; i<a.length; i++) {
                     members[i] = a.members[i];
                 }
+                length = a.length;
             }
+            JSONArray& operator=(const JSONArray&) = delete;
             ~JSONArray() {
-                if (members != NULL && allocated > 0) {
-                    delete members;
+                if (members != NULL && arena == nullptr) {
+                    delete [] members;
                 }
             }
             jsize_t trim() {
@@ -84,33 +532,70 @@ namespace JSON {
                 if (size < length) {
                     size = length;
                 }
-                JSON* newmembers = new JSON[size]();
+                JSON* newmembers = arena != nullptr ? arena->array<JSON>(size) : new JSON[size]();
                 for (jsize_t i=0; i<length; i++) {
-                    newmembers[i] = members[i];
+                    newmembers[i] = std::move(members[i]);
+                }
+                if (arena == nullptr) {
+                    delete [] members;
                 }
-                delete [] members;
                 members = newmembers;
                 allocated = size;
             }
+            /* Make room for at least size members. */
+            void reserve(jsize_t size) {
+                if (size > allocated) {
+                    resize(size);
+                }
+            }
+            /* Add object at the end of the array, returning it. Owned values are copied into the array's Arena if it has one. */
             JSON& append(JSON object) {
-                if (length + 1 >= allocated) {
-                    resize(allocated + MIN_ALLOC);
+                adopt(object);
+                if (length >= allocated) {
+                    resize(grown(length + 1));
                 }
-                members[length] = object;
+                members[length] = std::move(object);
 				return members[length++];
             }
+            /* Construct a new member at the end of the array from args, returning it. */
+            template<class... Args>
+            JSON& emplace(Args&&... args) {
+                JSON object(std::forward<Args>(args)...);
+                adopt(object);
+                if (length >= allocated) {
+                    resize(grown(length + 1));
+                }
+                members[length] = std::move(object);
+                return members[length++];
+            }
+            /* Insert object before member i, shifting the following members up. i may be equal to length. */
+            JSON& insert(jsize_t i, JSON object) {
+                if (i >= length) {
+                    return append(std::move(object));
+                }
+                adopt(object);
+                if (length >= allocated) {
+                    resize(grown(length + 1));
+                }
+                for (jsize_t k=length; k>i; k--) {
+                    members[k] = std::move(members[k-1]);
+                }
+                members[i] = std::move(object);
+                length++;
+                return members[i];
+            }
             void remove(jsize_t i) {
                 if (i < length) {
-                    if (i == length - 1) {
-                        members[length] = JSON();
-                    } else for (; i<length-1; i++)
-                        members[i] = members[i+1];
+                    for (; i<length-1; i++) {
+                        members[i] = std::move(members[i+1]);
+                    }
+                    members[length-1] = JSON();
                     length--;
                 }
             }
             JSON& get(jsize_t i) {
                 if (i >= allocated) {
-                    resize(i + MIN_ALLOC);
+                    resize(grown(i + 1));
                 }
                 if (i >= length) {
                     length = i+1;
@@ -124,8 +609,14 @@ namespace JSON {
                 return append(object);
             }
         };
+        /* Bits of flags. */
+        enum Flags {
+            // the string, array or object is freed with this value, and deep copied when it is copied
+            OWNED = 1,
+        };
         private:
-        jsize_t type = Type::Empty;
+        uint32_t type = Type::Empty;
+        uint32_t flags = 0;
         union value {
             const char* s;
             jdouble_t d;
@@ -135,34 +626,127 @@ namespace JSON {
             void* p;
         } value;
         void type_error() {
-            printf("Wrong type (0x%llX) for operation\n", type);
+            printf("Wrong type (0x%X) for operation\n", type);
             throw std::exception();
         }
+        // free the value if it is owned, leaving Empty
+        void destroy() {
+            if (flags & OWNED) {
+                switch (type) {
+                    case Type::String:
+                        free((void*)value.s);
+                        break;
+                    case Type::Array:
+                        delete value.a;
+                        break;
+                    case Type::Object:
+                        delete value.o;
+                        break;
+                }
+            }
+            type = Type::Empty;
+            flags = 0;
+            value.p = nullptr;
+        }
+        // move o's value into this one, which must be Empty, leaving o Empty
+        inline void take(JSON& o) {
+            type = o.type;
+            flags = o.flags;
+            value = o.value;
+            o.type = Type::Empty;
+            o.flags = 0;
+            o.value.p = nullptr;
+        }
         public:
-        JSON() {}
+        JSON() {
+            value.p = nullptr;
+        }
+        /* Take ownership of o, unless it allocates from an Arena. */
         JSON(JSONMap* o) {
             this->type = Type::Object;
             this->value.o = o;
+            this->flags = o->getArena() == nullptr ? OWNED : 0;
         }
+        /* Take ownership of a, unless it allocates from an Arena. */
         JSON(JSONArray* a) {
             this->type = Type::Array;
             this->value.a = a;
+            this->flags = a->arena == nullptr ? OWNED : 0;
         }
-        JSON(jlong_t i) {
+        template<class I, typename std::enable_if<std::is_integral<I>::value && !std::is_same<I, bool>::value, int>::type = 0>
+        JSON(I i) {
             this->type = Type::Integer;
-            this->value.i = i;
+            this->value.i = (jlong_t)i;
         }
         JSON(jdouble_t d) {
             this->type = Type::Float;
             this->value.d = d;
         }
-        JSON(char* s) {
-            this->type = Type::String;
-            this->value.s = s;
+        JSON(bool b) {
+            this->type = Type::Boolean;
+            this->value.i = b ? 1 : 0;
+        }
+        JSON(std::nullptr_t) {
+            this->type = Type::Null;
+            this->value.i = 0;
         }
+        /* Construct a string from a copy of s. Use JSON::borrow to point to s without copying it. */
+        JSON(const char* s) {
+            setString(s);
+        }
+        /* Construct a string from a copy of s. */
         JSON(std::string s) {
-            this->type = Type::String;
-            this->value.s = (char*) s.c_str();
+            setString(dupcstr(s), true);
+        }
+        /* Copy a value. Owned strings, arrays and objects are deep copied, anything else is shared. */
+        JSON(const JSON& o) {
+            if (o.flags & OWNED) {
+                JSON c = const_cast<JSON&>(o).clone();
+                take(c);
+            } else {
+                type = o.type;
+                flags = o.flags;
+                value = o.value;
+            }
+        }
+        JSON(JSON&& o) noexcept {
+            take(o);
+        }
+        JSON& operator=(const JSON& o) {
+            if (this != &o) {
+                // copy first, o may be a member of this value
+                JSON c(o);
+                destroy();
+                take(c);
+            }
+            return *this;
+        }
+        JSON& operator=(JSON&& o) noexcept {
+            if (this != &o) {
+                // o may be a member of this value, so detach it before freeing
+                JSON c(std::move(o));
+                destroy();
+                take(c);
+            }
+            return *this;
+        }
+        ~JSON() {
+            destroy();
+        }
+
+        /* Returns a new, empty, owned object. */
+        static JSON object() {
+            return JSON(new JSONMap());
+        }
+        /* Returns a new, empty, owned array with room for reserve members. */
+        static JSON array(jsize_t reserve=0) {
+            return JSON(new JSONArray(reserve));
+        }
+        /* Returns a string that points to s without copying or owning it. s must outlive the value. */
+        static JSON borrow(const char* s) {
+            JSON j;
+            j.setString(s, false);
+            return j;
         }
 
         static JSON* fromDouble(jdouble_t d) {
@@ -183,6 +767,20 @@ namespace JSON {
             return j;
         }
 
+        /* Returns the Flags bits of this value. */
+        inline uint32_t getFlags() {
+            return flags;
+        }
+        /* Returns true if this value frees its string, array or object when destroyed. */
+        inline bool isOwned() {
+            return flags & OWNED;
+        }
+        /* Give up ownership of the string, array or object without freeing it, returning the raw pointer. */
+        void* release() {
+            flags &= ~OWNED;
+            return value.p;
+        }
+
         JSONMap* set(JSONMap& o) { return setObject(o); }
         JSONMap* set(JSONMap* o) { return setObject(o); }
         JSONArray* set(JSONArray& a) { return setArray(a); }
@@ -223,30 +821,31 @@ namespace JSON {
             value.a->append(JSON());
             return value.a->get(value.a->length);
         }
-        JSON& operator[](std::string key) {
-            const char* s = key.c_str();
+        /* Index an object by key, adding a null member if it doesn't exist. */
+        JSON& operator[](std::string_view key) {
             if (type == Type::Object) {
-                if (value.o->has(s)) {
-                    return value.o->get(s);
-                }
-                return value.o->add(key.c_str(), JSON());
+                return value.o->get(key);
             }
             printf("Cannot index non-object with key string\n");
             throw std::exception();
         }
         JSON& operator[](char* key) {
             if (type == Type::Object) {
-                if (value.o->has(key)) {
-                    return value.o->get(key);
-                }
-                return value.o->add(key, JSON());
+                return value.o->get(key);
             }
             printf("Cannot index non-object with key string\n");
             throw std::exception();
         }
-        bool contains(std::string key) {
+        JSON& operator[](const HashedKey<>& key) {
             if (type == Type::Object) {
-                return value.o->has(key.c_str());
+                return value.o->get(key);
+            }
+            printf("Cannot index non-object with key string\n");
+            throw std::exception();
+        }
+        bool contains(std::string_view key) {
+            if (type == Type::Object) {
+                return value.o->has(key);
             }
             return false;
         }
@@ -256,6 +855,23 @@ namespace JSON {
             }
             return false;
         }
+        bool contains(const HashedKey<>& key) {
+            if (type == Type::Object) {
+                return value.o->has(key);
+            }
+            return false;
+        }
+        /* Returns a pointer to the member named key, or nullptr if there isn't one or this isn't an object.
+           Use this instead of contains followed by operator[] to look the key up once. */
+        JSON* find(std::string_view key) {
+            return type == Type::Object ? value.o->find(key) : nullptr;
+        }
+        JSON* find(const char* key) {
+            return type == Type::Object ? value.o->find(key) : nullptr;
+        }
+        JSON* find(const HashedKey<>& key) {
+            return type == Type::Object ? value.o->find(key) : nullptr;
+        }
         const char* getCString() {
             if (type != Type::String) {
                 type_error();
@@ -329,316 +945,705 @@ namespace JSON {
             return* value.a;
         }
 
+        /* Set to a deep copy of o. */
         JSONMap* setObject(JSONMap& o) {
-            this->type = Type::Object;
-            this->value.o = new JSONMap(o);
+            JSON view;
+            view.type = Type::Object;
+            view.value.o = &o;
+            *this = view.clone();
 			return this->value.o;
         }
+        /* Set to o, taking ownership of it unless it allocates from an Arena. */
         JSONMap* setObject(JSONMap* o) {
-            this->type = Type::Object;
-            this->value.o = o;
+            *this = JSON(o);
 			return this->value.o;
         }
+        /* Set to a copy of a. */
         JSONArray* setArray(JSONArray& a) {
-            this->type = Type::Array;
-            this->value.a = new JSONArray(a);
+            *this = JSON(new JSONArray(a));
 			return this->value.a;
         }
+        /* Set to a, taking ownership of it unless it allocates from an Arena. */
         JSONArray* setArray(JSONArray* a) {
-            this->type = Type::Array;
-            this->value.a = a;
+            *this = JSON(a);
 			return this->value.a;
         }
         jdouble_t setFloat(jdouble_t d) {
+            destroy();
             this->type = Type::Float;
             this->value.d = d;
 			return d;
         }
         jlong_t setInteger(jlong_t i) {
+            destroy();
             this->type = Type::Integer;
             this->value.i = i;
 			return i;
         }
+        /* Set to a copy of s, owned by this value. */
         const char* setString(const char* s) {
+            return setString(s == nullptr ? nullptr : dupcstr(s, strlen(s)), s != nullptr);
+        }
+        /* Set to a string that points to s without copying it.
+           If owned is set, s must be allocated with malloc and is freed with this value, otherwise s must outlive the value. */
+        const char* setString(const char* s, bool owned) {
+            destroy();
             this->type = Type::String;
+            this->flags = owned ? OWNED : 0;
             this->value.s = s;
 			return s;
         }
+        /* Set to a copy of s. */
         std::string setString(std::string s) {
-            this->type = Type::String;
-            this->value.s = (char*)s.c_str();
+            setString(dupcstr(s), true);
 			return s;
         }
         bool setBoolean(bool v) {
+            destroy();
             this->type = Type::Boolean;
             this->value.i = v ? 1 : 0;
 			return v;
         }
         void setNull() {
+            destroy();
             this->type = Type::Null;
             this->value.i = 0;
         }
         void* setCustom(void* p, jsize_t t) {
+            destroy();
             this->type = t;
             this->value.p = p;
             return p;
         }
 
-        const char* serialize() {
-            jsize_t len;
-            std::string o = std::string();
+        /* Construct a new object member from args, replacing any existing member with the same key. Returns the member. */
+        template<class... Args>
+        JSON& emplace(const char* key, Args&&... args) {
+            if (type != Type::Object) {
+                type_error();
+            }
+            JSON v(std::forward<Args>(args)...);
+            Arena* arena = value.o->getArena();
+            if (arena != nullptr && v.isOwned()) {
+                v = v.clone(arena);
+            }
+            return value.o->get(key) = std::move(v);
+        }
+        /* Construct a new member at the end of an array from args, returning it. */
+        template<class... Args>
+        JSON& emplaceBack(Args&&... args) {
+            if (type != Type::Array) {
+                type_error();
+            }
+            return value.a->emplace(std::forward<Args>(args)...);
+        }
+
+        /* Returns a deep copy of this value, allocated from arena if given. Custom type values are copied by pointer. */
+        JSON clone(Arena* arena=nullptr) {
+            JSON o;
             switch (type) {
-                case Type::Empty:
-                    break;
-                case Type::Null:
-                    o = "null";
-                    break;
-                case Type::Boolean:
-                    o = value.i?"true":"false";
-                    break;
-                case Type::Integer:
-                    o = std::to_string(value.i);
-                    break;
-                case Type::Float:
-                    o = std::to_string(value.d);
-                    break;
                 case Type::String:
-                    if (value.s != NULL) {
-                        o.reserve(strlen(value.s)+3);
-                        int j = 0;
-                        o[j++] = '"';
-                        for (int i=0; value.s[i]>0; i++) {
-                            if (value.s[i] == '\n') {
-                                o[j++] = '\\';
-                                o[j++] = 'n';
-                            } else if (value.s[i] == '\t') {
-                                o[j++] = '\\';
-                                o[j++] = 't';
-                            } else if (value.s[i] == '"') {
-                                o[j++] = '\\';
-                                o[j++] = '"';
-                            } else {
-                                o[j++] = value.s[i];
-                            }
-                        }
-                        o[j++] = '"';
+                    if (value.s == nullptr || arena != nullptr) {
+                        o.setString(value.s == nullptr ? nullptr : arena->strdup(value.s), false);
                     } else {
-                        o.append("\"\"");
+                        o.setString(dupcstr(value.s, strlen(value.s)), true);
                     }
                     break;
-                case Type::Array:
-                    o.reserve(value.a->length*4);
-                    o.append("[");
+                case Type::Array: {
+                    JSONArray* a = arena != nullptr ? arena->create<JSONArray>(arena, value.a->length) : new JSONArray(value.a->length);
                     for (jsize_t i=0; i<value.a->length; i++) {
-                        o.append(value.a->get(i).serialize());
-                        if (i+1<value.a->length) {
-                            o.append(",");
-                            if (value.a->get(i).getType() == Type::Array || value.a->get(i).getType() == Type::Object) {
-                                o.append("\n");
-                            }
-                        }
+                        a->members[i] = value.a->members[i].clone(arena);
                     }
-                    o.append("]");
+                    a->length = value.a->length;
+                    o.setArray(a);
                     break;
-                case Type::Object:
-                    len = value.o->length();
-                    o.reserve(len*6);
-                    o.append("{");
-                    for (jsize_t i=0; i<len; i++) {
-                        o.append("\"");
-                        o.append(value.o->keys(i));
-                        o.append("\": ");
-                        o.append(value.o->values(i).serialize());
-                        if (i+1 < len) {
-                            o.append(",\n");
-                        }
+                }
+                case Type::Object: {
+                    StringPool<>* pool = value.o->getPool();
+                    JSONMap* m = arena != nullptr ? arena->create<JSONMap>(pool, arena) : new JSONMap(pool);
+                    for (JSONMap::Entry& e : *value.o) {
+                        m->get(std::string_view(e.key, e.length)) = e.value.clone(arena);
                     }
-                    o.append("}");
+                    o.setObject(m);
                     break;
+                }
                 default:
-                    printf("Cannot serialize custom type with default method.\n\
-                        Override the serialize() method for your custom type class if you need it.");
-                    throw std::exception();
+                    o = *this;
                     break;
             }
-            o.shrink_to_fit();
-            return dupcstr(o);
+            return o;
+        }
+
+        /* Serialize to compact JSON. Returns a NUL-terminated string allocated with malloc, free it with free(). */
+        const char* serialize() {
+            return serialize(false);
         }
+        /* Serialize to compact or pretty-printed JSON. Returns a NUL-terminated string allocated with malloc, free it with free(). */
+        const char* serialize(bool pretty);
+        /* Serialize into a Writer. */
+        void serialize(Writer& w);
 
+        /* Parse a NUL-terminated JSON document. Throws ParseError on invalid input. */
         static JSON deserialize(const char* data) {
-            jsize_t i = 0;
-            return deserialize(data, i);
+            return deserialize(data, strlen(data));
         }
 
-        private:
-        static char nibble(char c) {
-            if (c >= '0' && c <= '9') {
-                return c - '0';
-            } else if (c >= 'A' && c <= 'F') {
-                return c + 10 - 'A';
-            } else if (c >= 'a' && c <= 'f') {
-                return c + 10 - 'a';
-            } else {
-                return 0;
-            }
+        /* Parse len bytes of JSON. The data does not need to be NUL-terminated. Throws ParseError on invalid input. */
+        static JSON deserialize(const char* data, jsize_t len) {
+            return deserialize(data, len, nullptr);
         }
-        static void skipspace(const char* data, jsize_t &i) {
-            while (data[i] == ' ' || data[i] == '\t' || data[i] == '\n' || data[i] == ',') {
-                i++;
-            }
+
+        /* Parse len bytes of JSON, allocating every array, object, key and string from arena when it is not null.
+           Object keys are interned in pool instead when it is not null, so repeated keys are stored once. pool must outlive the result.
+           Throws ParseError on invalid input. */
+        static JSON deserialize(const char* data, jsize_t len, Arena* arena, StringPool<>* pool=nullptr) {
+            Tokenizer t(data, len);
+            return deserialize(t, arena, pool);
         }
-        static char nextchar(const char* data, jsize_t &i) {
-            skipspace(data, i);
-            char c = data[i++];
-            skipspace(data, i);
-            return c;
+
+        /* Parse a NUL-terminated JSON document in place. See deserializeInSitu(char*, jsize_t, Arena*). */
+        static JSON deserializeInSitu(char* data, Arena* arena=nullptr) {
+            return deserializeInSitu(data, strlen(data), arena);
+        }
+
+        /* Parse len bytes of JSON in place, without copying strings.
+           Strings are unescaped over the input and NUL-terminated, and string values and object keys point into data,
+           so data must outlive the result. Arrays and objects are allocated from arena when it is not null.
+           Throws ParseError on invalid input. */
+        static JSON deserializeInSitu(char* data, jsize_t len, Arena* arena=nullptr) {
+            Tokenizer t(data, len, true);
+            return deserialize(t, arena);
+        }
+        /* Parse one value starting at token tok, leaving t just after it. */
+        static JSON deserialize(Tokenizer& t, Tokenizer::Token tok, Arena* arena=nullptr, StringPool<>* pool=nullptr) {
+            std::vector<JSON> stack;
+            return deserialize(t, tok, 0, arena, pool, stack);
+        }
+
+        private:
+        static JSON deserialize(Tokenizer& t, Arena* arena, StringPool<>* pool=nullptr) {
+            std::vector<JSON> stack;
+            JSON o = deserialize(t, t.next(), 0, arena, pool, stack);
+            if (t.next() != Tokenizer::End) {
+                t.error("unexpected data after document");
+            }
+            return o;
         }
 
-        static JSON deserialize(const char* data, jsize_t& i) {
+        static const jsize_t MAX_DEPTH = 1024;
+
+        // array members are collected on stack so each array is allocated once at its final size
+        static JSON deserialize(Tokenizer& t, Tokenizer::Token tok, jsize_t depth, Arena* arena, StringPool<>* pool, std::vector<JSON>& stack) {
             JSON o;
-            skipspace(data, i);
-            char c = data[i];
-            if (c >= 'a' && c <= 'z') {
-                if (!strncmp(&data[i], "null", 4)) {
+            switch (tok) {
+                case Tokenizer::Null:
                     o.setNull();
-                    i += 4;
-                } else if (!strncmp(&data[i], "false", 5)) {
-                    o.setBoolean(false);
-                    i += 5;
-                } else if (!strncmp(&data[i], "true", 4)) {
+                    break;
+                case Tokenizer::True:
+                    o.setBoolean(true);
+                    break;
+                case Tokenizer::False:
                     o.setBoolean(false);
-                    i += 4;
-                } else {
-                    o.setNull();
-                }
-            } else if (c >= '0' && c <= '9' || c == '-') {
-                jsize_t j;
-                bool flt = false;
-                bool neg = false;
-                bool hex = false;
-                if (c == '-') {
-                    neg = true;
-                    c = data[++i];
-                }
-                if (c == '0' && data[i+1] == 'x') {
-                    hex = true;
-                    i+=2;
-                }
-                j = i;
-                while (c != ',' && c != ']' && c != '}') {
-                    c = data[j++];
-                    if (c == '.') {
-                        flt = true;
-                    }
-                }
-                if (hex) {
-                    jlong_t num = 0;
-                    for (; i<j; j++) {
-                        num = (num<<4) + nibble(data[i]);
+                    break;
+                case Tokenizer::Integer:
+                    o.setInteger(t.i);
+                    break;
+                case Tokenizer::Float:
+                    o.setFloat(t.d);
+                    break;
+                case Tokenizer::String:
+                    if (t.insitu) {
+                        o.setString(t.s, false);
+                    } else if (arena != nullptr) {
+                        o.setString(arena->strdup(t.s, t.slen), false);
+                    } else {
+                        o.setString(dupcstr(t.s, t.slen), true);
                     }
-                    if (neg) {
-                        num = -num;
+                    break;
+                case Tokenizer::BeginArray: {
+                    if (depth >= MAX_DEPTH) {
+                        t.error("nesting too deep");
                     }
-                    o.setInteger(num);
-                } else if (flt) {
-                    jdouble_t num = 0;
-                    jdouble_t f = 1.0;
-                    flt = false;
-                    for (; i<j; i++) {
-                        if (data[i] >= '0' && data[i] <= '9') {
-                            if (flt) {
-                                f *= 0.1;
-                                num += f*(data[i] - '0');
-                            } else {
-                                num = num * 10 + data[i] - '0';
+                    jsize_t base = stack.size();
+                    tok = t.next();
+                    if (tok != Tokenizer::EndArray) {
+                        while (true) {
+                            stack.push_back(deserialize(t, tok, depth + 1, arena, pool, stack));
+                            tok = t.next();
+                            if (tok == Tokenizer::EndArray) {
+                                break;
+                            } else if (tok != Tokenizer::Comma) {
+                                t.error("expected ',' or ']'");
                             }
-                        } else if (data[i] == '.') {
-                            flt = true;
+                            tok = t.next();
                         }
                     }
-                    if (neg) {
-                        num = -num;
+                    jsize_t n = stack.size() - base;
+                    JSONArray* a = arena != nullptr ? arena->create<JSONArray>(arena, n) : new JSONArray(n);
+                    for (jsize_t k=0; k<n; k++) {
+                        a->members[k] = std::move(stack[base + k]);
                     }
-                    o.setFloat(num);
-                } else {
-                    jlong_t num = 0;
-                    for (; i<j; i++) {
-                        if (data[i] >= '0' && data[i] <= '9') {
-                            num = num * 10 + data[i] - '0';
-                        }
+                    a->length = n;
+                    stack.resize(base);
+                    o.setArray(a);
+                    break;
+                }
+                case Tokenizer::BeginObject: {
+                    if (depth >= MAX_DEPTH) {
+                        t.error("nesting too deep");
                     }
-                    if (neg) {
-                        num = -num;
+                    JSONMap* m = arena != nullptr ? arena->create<JSONMap>(pool, arena) : new JSONMap(pool);
+                    o.setObject(m);
+                    tok = t.next();
+                    if (tok == Tokenizer::EndObject) {
+                        break;
                     }
-                    o.setInteger(num);
-                }
-                i--;
-            } else if (c == '"') {
-                std::string s;
-                i++;
-                do {
-                    c = data[i++];
-                    if (c == '\\') {
-                        if (data[i] == 'n') {
-                            s += '\n';
-                        } else if (data[i] == 't') {
-                            s += '\t';
-                        } else if (data[i] == 'r') {
-                            s += '\r';
-                        } else if (data[i] == '0') {
-                            s += '\0';
-                        } else if (data[i] == 'x') {
-                            i++;
-                            s += (nibble(data[i]) << 4) | nibble(data[i+1]);
-                            i += 2;
-                        } else {
-                            s += c;
-                            s += data[i++];
+                    while (true) {
+                        if (tok != Tokenizer::String) {
+                            t.error("expected string key");
                         }
-                    } else if (c != '"') {
-                        s += c;
+                        // create the slot now, the key buffer is reused while parsing the value.
+                        // In situ keys already live in the input, so they are borrowed rather than pooled
+                        JSON& slot = t.insitu ? m->getBorrowed(t.s, t.slen) : m->get(std::string_view(t.s, t.slen));
+                        if (t.next() != Tokenizer::Colon) {
+                            t.error("expected ':'");
+                        }
+                        slot = deserialize(t, t.next(), depth + 1, arena, pool, stack);
+                        tok = t.next();
+                        if (tok == Tokenizer::EndObject) {
+                            break;
+                        } else if (tok != Tokenizer::Comma) {
+                            t.error("expected ',' or '}'");
+                        }
+                        tok = t.next();
                     }
-                } while (c != '"');
-                o.setString(dupcstr(s));
-            } else if (c == '[') {
-                JSONArray* a = new JSONArray();
-                i++;
-                skipspace(data, i);
-                c = data[i];
-                while (c != ']') {
-                    skipspace(data, i);
-                    JSON j = deserialize(data, i);
-                    a->append(j);
-                    skipspace(data, i);
-                    c = data[i];
-                }
-                i++;
-                o.setArray(a);
-            } else if (c == '{') {
-                JSONMap* a = new JSONMap();
-                i++;
-                skipspace(data, i);
-                c = data[i];
-                while (c != '}') {
-                    skipspace(data, i);
-                    const char* key = deserialize(data, i).getCString();
-                    if (data[i] == ':') {
-                        i++;
+                    break;
+                }
+                case Tokenizer::End:
+                    t.error("unexpected end of input");
+                default:
+                    t.error("unexpected token");
+            }
+            return o;
+        }
+
+    };
+
+    /* Streaming JSON writer.
+     * Output goes into one growable buffer, or is handed to a sink function whenever the buffer fills up.
+     * Floats are written in the shortest form that reads back to the same double.
+     * Values can be written from a JSON tree with value(), or piece by piece with the startObject()/key()/... functions.
+     */
+    class Writer {
+        static const jsize_t FLUSH_SIZE = 64 * 1024;
+        char* buf = nullptr;
+        jsize_t len = 0;
+        jsize_t allocated = 0;
+        bool pretty;
+        jsize_t indent;
+        bool afterkey = false;
+        // number of values written so far in each open container
+        std::vector<jsize_t> counts;
+        std::function<void(const char*, jsize_t)> sink;
+        const scan::Kernels& kernels;
+
+        void grow(jsize_t n) {
+            jsize_t size = allocated < 256 ? 256 : allocated;
+            while (size < len + n) {
+                size *= 2;
+            }
+            char* b = (char*) realloc(buf, size);
+            if (b == nullptr) {
+                printf("JSON::Writer out of memory");
+                throw std::exception();
+            }
+            buf = b;
+            allocated = size;
+        }
+        inline char* reserve(jsize_t n) {
+            if (len + n > allocated) {
+                grow(n);
+            }
+            return buf + len;
+        }
+        inline void put(char c) {
+            *reserve(1) = c;
+            len++;
+        }
+        inline void put(const char* s, jsize_t n) {
+            memcpy(reserve(n), s, n);
+            len += n;
+        }
+        void newline(jsize_t depth) {
+            char* p = reserve(depth * indent + 1);
+            *p++ = '\n';
+            memset(p, ' ', depth * indent);
+            len += depth * indent + 1;
+        }
+        // comma and indentation before a value or key
+        void prefix() {
+            if (afterkey) {
+                afterkey = false;
+                return;
+            }
+            if (!counts.empty()) {
+                if (counts.back()++ > 0) {
+                    put(',');
+                }
+                if (pretty) {
+                    newline(counts.size());
+                }
+            }
+        }
+        inline void done() {
+            if (sink && len >= FLUSH_SIZE) {
+                flush();
+            }
+        }
+        void open(char c) {
+            prefix();
+            put(c);
+            counts.push_back(0);
+        }
+        void close(char c) {
+            if (counts.empty()) {
+                printf("JSON::Writer container end without start\n");
+                throw std::exception();
+            }
+            jsize_t n = counts.back();
+            counts.pop_back();
+            if (pretty && n > 0) {
+                newline(counts.size());
+            }
+            put(c);
+            done();
+        }
+        void quoted(const char* s, jsize_t n) {
+            static const char hex[] = "0123456789abcdef";
+            const char* end = s + n;
+            put('"');
+            while (true) {
+                const char* run = s;
+                s = kernels.string(s, end);
+                put(run, s - run);
+                if (s >= end) {
+                    break;
+                }
+                unsigned char c = *s++;
+                char* p = reserve(6);
+                p[0] = '\\';
+                switch (c) {
+                    case '"': p[1] = '"'; len += 2; break;
+                    case '\\': p[1] = '\\'; len += 2; break;
+                    case '\n': p[1] = 'n'; len += 2; break;
+                    case '\t': p[1] = 't'; len += 2; break;
+                    case '\r': p[1] = 'r'; len += 2; break;
+                    case '\b': p[1] = 'b'; len += 2; break;
+                    case '\f': p[1] = 'f'; len += 2; break;
+                    default:
+                        p[1] = 'u';
+                        p[2] = '0';
+                        p[3] = '0';
+                        p[4] = hex[c >> 4];
+                        p[5] = hex[c & 15];
+                        len += 6;
+                        break;
+                }
+            }
+            put('"');
+        }
+
+        public:
+        /* Construct a Writer that collects output in its own buffer. */
+        Writer(bool pretty=false, jsize_t indent=4) : kernels(scan::kernels()) {
+            this->pretty = pretty;
+            this->indent = indent;
+        }
+        /* Construct a Writer that passes output to sink whenever 64KB is buffered, and on flush() or destruction. */
+        Writer(std::function<void(const char*, jsize_t)> sink, bool pretty=false, jsize_t indent=4) : Writer(pretty, indent) {
+            this->sink = sink;
+        }
+        /* Construct a Writer that writes output to a FILE*. */
+        Writer(FILE* fd, bool pretty=false, jsize_t indent=4) : Writer([fd](const char* s, jsize_t n) {
+            fwrite(s, 1, n, fd);
+        }, pretty, indent) {}
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+        ~Writer() {
+            if (sink) {
+                flush();
+            }
+            free(buf);
+        }
+
+        /* Returns the buffered output. It is NUL-terminated. */
+        const char* data() {
+            *reserve(1) = 0;
+            return buf;
+        }
+        /* Returns the number of buffered bytes. */
+        inline jsize_t length() {
+            return len;
+        }
+        /* Discard the buffered output and any open containers. */
+        void clear() {
+            len = 0;
+            afterkey = false;
+            counts.clear();
+        }
+        /* Pass the buffered output to the sink. */
+        void flush() {
+            if (sink && len > 0) {
+                sink(buf, len);
+            }
+            len = 0;
+        }
+        /* Take ownership of the buffered output as a NUL-terminated string allocated with malloc. */
+        char* release() {
+            *reserve(1) = 0;
+            char* b = buf;
+            buf = nullptr;
+            len = allocated = 0;
+            counts.clear();
+            return b;
+        }
+
+        /* Write raw bytes, e.g. a newline between NDJSON records. */
+        void raw(const char* s, jsize_t n) {
+            put(s, n);
+            done();
+        }
+
+        void startObject() {
+            open('{');
+        }
+        void endObject() {
+            close('}');
+        }
+        void startArray() {
+            open('[');
+        }
+        void endArray() {
+            close(']');
+        }
+        /* Write an object key. The next value written is its value. */
+        void key(const char* s, jsize_t n) {
+            prefix();
+            quoted(s, n);
+            if (pretty) {
+                put(": ", 2);
+            } else {
+                put(':');
+            }
+            afterkey = true;
+        }
+        void key(const char* s) {
+            key(s, strlen(s));
+        }
+        void string(const char* s, jsize_t n) {
+            prefix();
+            quoted(s, n);
+            done();
+        }
+        void string(const char* s) {
+            string(s, strlen(s));
+        }
+        void integer(jlong_t i) {
+            prefix();
+            char* p = reserve(24);
+            len += std::to_chars(p, p + 24, i).ptr - p;
+            done();
+        }
+        void floating(jdouble_t d) {
+            prefix();
+            if (!std::isfinite(d)) {
+                // JSON has no representation for NaN or infinity
+                put("null", 4);
+                done();
+                return;
+            }
+            char* p = reserve(32);
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+            char* e = std::to_chars(p, p + 32, d).ptr;
+#else
+            char* e = p + snprintf(p, 32, "%.17g", d);
+#endif
+            // keep a decimal point so the value reads back as a float
+            bool integral = true;
+            for (char* c=p; c<e; c++) {
+                if (*c == '.' || *c == 'e' || *c == 'E') {
+                    integral = false;
+                    break;
+                }
+            }
+            if (integral) {
+                *e++ = '.';
+                *e++ = '0';
+            }
+            len += e - p;
+            done();
+        }
+        void boolean(bool b) {
+            prefix();
+            if (b) {
+                put("true", 4);
+            } else {
+                put("false", 5);
+            }
+            done();
+        }
+        void null() {
+            prefix();
+            put("null", 4);
+            done();
+        }
+        /* Write a JSON value and all of its children. */
+        void value(JSON& j) {
+            switch (j.getCustomType()) {
+                case Type::Empty:
+                    break;
+                case Type::Null:
+                    null();
+                    break;
+                case Type::Boolean:
+                    boolean(j.getBoolean());
+                    break;
+                case Type::Integer:
+                    integer(j.getInteger());
+                    break;
+                case Type::Float:
+                    floating(j.getFloat());
+                    break;
+                case Type::String: {
+                    const char* s = j.getCString();
+                    string(s != nullptr ? s : "");
+                    break;
+                }
+                case Type::Array: {
+                    JSON::JSONArray& a = j.getArray();
+                    startArray();
+                    for (jsize_t i=0; i<a.length; i++) {
+                        value(a.members[i]);
                     }
-                    skipspace(data, i);
-                    if (data[i] == ':') {
-                        i++;
+                    endArray();
+                    break;
+                }
+                case Type::Object: {
+                    startObject();
+                    for (JSONMap::Entry& e : j.getObject()) {
+                        key(e.key, e.length);
+                        value(e.value);
                     }
-                    a->add(dupcstr(std::string(key)), deserialize(data, i));
-                    skipspace(data, i);
-                    c = data[i];
+                    endObject();
+                    break;
                 }
-                i++;
-                o.setObject(a);
+                default:
+                    printf("Cannot serialize custom type with default method.\n\
+                        Override the serialize() method for your custom type class if you need it.");
+                    throw std::exception();
             }
-            return o;
         }
+    };
+
+    inline const char* JSON::serialize(bool pretty) {
+        Writer w(pretty);
+        w.value(*this);
+        return w.release();
+    }
 
+    inline void JSON::serialize(Writer& w) {
+        w.value(*this);
+    }
+
+    /* A JSON document that owns all of its nodes.
+     * Arrays, objects, keys and strings are carved from an Arena, so parsing does no per-node heap allocation
+     * and the whole tree is freed at once when the Document is destroyed or re-parsed.
+     * Because the nodes are never destroyed, a value assigned directly to a member (doc.root()["x"] = ...) must not
+     * own heap storage, or it leaks. Assign JSON::borrow(s), a value from newString/newObject/newArray, or adopt(value).
+     * append, insert, emplace and emplaceBack on the Document's arrays and objects copy owned values into the Arena themselves.
+     */
+    class Document {
+        Arena arena;
+        JSON rootnode;
+        StringPool<>* pool = nullptr;
+        public:
+        /* Construct an empty Document. chunksize is the size of the first Arena chunk. */
+        Document(jsize_t chunksize=64*1024) : arena(chunksize) {}
+        /* Construct a Document by parsing a NUL-terminated JSON string. */
+        Document(const char* data) : Document() {
+            parse(data);
+        }
+        /* Construct a Document by parsing len bytes of JSON. */
+        Document(const char* data, jsize_t len) : Document() {
+            parse(data, len);
+        }
+        /* Parse a NUL-terminated JSON string, freeing the previous contents. Throws ParseError on invalid input. */
+        JSON& parse(const char* data) {
+            return parse(data, strlen(data));
+        }
+        /* Parse len bytes of JSON, freeing the previous contents. Throws ParseError on invalid input. */
+        JSON& parse(const char* data, jsize_t len) {
+            rootnode = JSON();
+            arena.release();
+            rootnode = JSON::deserialize(data, len, &arena, pool);
+            return rootnode;
+        }
+        /* Parse a NUL-terminated JSON string in place, freeing the previous contents.
+           Strings and keys point into data, which must outlive the Document. Throws ParseError on invalid input. */
+        JSON& parseInSitu(char* data) {
+            return parseInSitu(data, strlen(data));
+        }
+        /* Parse len bytes of JSON in place, freeing the previous contents.
+           Strings and keys point into data, which must outlive the Document. Throws ParseError on invalid input. */
+        JSON& parseInSitu(char* data, jsize_t len) {
+            rootnode = JSON();
+            arena.release();
+            rootnode = JSON::deserializeInSitu(data, len, &arena);
+            return rootnode;
+        }
+        /* Returns the root value. */
+        JSON& root() {
+            return rootnode;
+        }
+        JSON& operator*() {
+            return rootnode;
+        }
+        JSON* operator->() {
+            return &rootnode;
+        }
+        /* Returns the Arena that owns this Document's nodes. */
+        Arena& getArena() {
+            return arena;
+        }
+        /* Intern the object keys of documents parsed from now on in pool, or copy them into the Arena if pool is null.
+           Sharing one pool between Documents stores each distinct key once. The pool must outlive the Document. */
+        void setPool(StringPool<>* pool) {
+            this->pool = pool;
+        }
+        StringPool<>* getPool() {
+            return pool;
+        }
+        /* Create an empty object owned by this Document. */
+        JSON newObject() {
+            return JSON(arena.create<JSONMap>(pool, &arena));
+        }
+        /* Create an empty array owned by this Document. */
+        JSON newArray(jsize_t reserve=0) {
+            return JSON(arena.create<JSON::JSONArray>(&arena, reserve));
+        }
+        /* Create a string owned by this Document. */
+        JSON newString(const char* s) {
+            JSON j;
+            j.setString(arena.strdup(s), false);
+            return j;
+        }
+        /* Returns value, deep copied into this Document if it owns its storage, so it can be assigned to a member. */
+        JSON adopt(JSON value) {
+            if (value.isOwned()) {
+                return value.clone(&arena);
+            }
+            return value;
+        }
     };
 	typedef JSON::JSON::JSONArray JSONArray;
 	typedef Dictionary<JSON> JSONObject;
@@ -648,7 +1653,11 @@ namespace JSON {
     }
 
     static JSON deserialize(std::string s) {
-        return JSON::deserialize(s.c_str());
+        return JSON::deserialize(s.c_str(), s.length());
+    }
+
+    inline JSON deserialize(const char* s, jsize_t len) {
+        return JSON::deserialize(s, len);
     }
 
 }
@@ -0,0 +1,527 @@
+/* Binary encoding of JSON values as CBOR (RFC 8949).
+ * Integers, floats, strings, booleans, null, arrays and objects map directly onto CBOR major types,
+ * so a round trip keeps every value exactly, including the bits of floats.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  JSON::jsize_t len;
+ *  uint8_t* data = JSON::CBOR::encode(json, len);
+ *  JSON::JSON copy = JSON::CBOR::decode(data, len);
+ *  free(data);
+ */
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "Arena.hpp"
+#include "Json.hpp"
+
+namespace JSON {
+    /* Streaming CBOR writer.
+     * Output goes into one growable buffer. Containers are written with their length up front,
+     * so startArray() and startObject() take the number of members that will follow.
+     * Floats are written as single precision when that is exact, double precision otherwise.
+     */
+    class CBORWriter {
+        uint8_t* buf = nullptr;
+        jsize_t len = 0;
+        jsize_t allocated = 0;
+
+        void grow(jsize_t n) {
+            jsize_t size = allocated < 256 ? 256 : allocated;
+            while (size < len + n) {
+                size *= 2;
+            }
+            uint8_t* b = (uint8_t*) realloc(buf, size);
+            if (b == nullptr) {
+                printf("JSON::CBORWriter out of memory");
+                throw std::exception();
+            }
+            buf = b;
+            allocated = size;
+        }
+        inline uint8_t* reserve(jsize_t n) {
+            if (len + n > allocated) {
+                grow(n);
+            }
+            return buf + len;
+        }
+        inline void put(const void* s, jsize_t n) {
+            memcpy(reserve(n), s, n);
+            len += n;
+        }
+        // major type and argument, in the shortest form
+        void head(uint8_t major, uint64_t v) {
+            uint8_t* p = reserve(9);
+            major <<= 5;
+            if (v < 24) {
+                p[0] = major | v;
+                len += 1;
+            } else if (v <= 0xFF) {
+                p[0] = major | 24;
+                p[1] = v;
+                len += 2;
+            } else if (v <= 0xFFFF) {
+                p[0] = major | 25;
+                p[1] = v >> 8;
+                p[2] = v;
+                len += 3;
+            } else if (v <= 0xFFFFFFFF) {
+                p[0] = major | 26;
+                for (int i=0; i<4; i++) {
+                    p[1+i] = v >> (24 - 8*i);
+                }
+                len += 5;
+            } else {
+                p[0] = major | 27;
+                for (int i=0; i<8; i++) {
+                    p[1+i] = v >> (56 - 8*i);
+                }
+                len += 9;
+            }
+        }
+
+        public:
+        CBORWriter() {}
+        CBORWriter(const CBORWriter&) = delete;
+        CBORWriter& operator=(const CBORWriter&) = delete;
+        ~CBORWriter() {
+            free(buf);
+        }
+
+        /* Returns the encoded output. */
+        inline const uint8_t* data() {
+            return buf;
+        }
+        /* Returns the number of encoded bytes. */
+        inline jsize_t length() {
+            return len;
+        }
+        /* Discard the encoded output. */
+        void clear() {
+            len = 0;
+        }
+        /* Take ownership of the encoded output, allocated with malloc. */
+        uint8_t* release() {
+            uint8_t* b = buf;
+            if (b == nullptr) {
+                b = (uint8_t*) malloc(1);
+            }
+            buf = nullptr;
+            len = allocated = 0;
+            return b;
+        }
+
+        /* Start an object of count key:value pairs. Write key() then the value for each. */
+        void startObject(jsize_t count) {
+            head(5, count);
+        }
+        /* Start an array of count members. */
+        void startArray(jsize_t count) {
+            head(4, count);
+        }
+        void key(const char* s, jsize_t n) {
+            string(s, n);
+        }
+        void key(const char* s) {
+            string(s, strlen(s));
+        }
+        void string(const char* s, jsize_t n) {
+            head(3, n);
+            put(s, n);
+        }
+        void string(const char* s) {
+            string(s, strlen(s));
+        }
+        void integer(jlong_t i) {
+            if (i < 0) {
+                // negative integers are stored as -1 - n
+                head(1, (uint64_t)(-1 - i));
+            } else {
+                head(0, (uint64_t)i);
+            }
+        }
+        void floating(jdouble_t d) {
+            float f = (float)d;
+            jdouble_t back = f;
+            uint8_t* p = reserve(9);
+            // compare bits rather than values so -0.0 and NaN payloads are kept
+            if (memcmp(&back, &d, 8) == 0) {
+                uint32_t bits;
+                memcpy(&bits, &f, 4);
+                p[0] = 0xFA;
+                for (int i=0; i<4; i++) {
+                    p[1+i] = bits >> (24 - 8*i);
+                }
+                len += 5;
+                return;
+            }
+            uint64_t bits;
+            memcpy(&bits, &d, 8);
+            p[0] = 0xFB;
+            for (int i=0; i<8; i++) {
+                p[1+i] = bits >> (56 - 8*i);
+            }
+            len += 9;
+        }
+        void boolean(bool b) {
+            *reserve(1) = b ? 0xF5 : 0xF4;
+            len++;
+        }
+        void null() {
+            *reserve(1) = 0xF6;
+            len++;
+        }
+        /* Write the undefined value, which decodes to Type::Empty. */
+        void undefined() {
+            *reserve(1) = 0xF7;
+            len++;
+        }
+        /* Write a JSON value and all of its children. */
+        void value(JSON& j) {
+            switch (j.getCustomType()) {
+                case Type::Empty:
+                    undefined();
+                    break;
+                case Type::Null:
+                    null();
+                    break;
+                case Type::Boolean:
+                    boolean(j.getBoolean());
+                    break;
+                case Type::Integer:
+                    integer(j.getInteger());
+                    break;
+                case Type::Float:
+                    floating(j.getFloat());
+                    break;
+                case Type::String: {
+                    const char* s = j.getCString();
+                    string(s != nullptr ? s : "");
+                    break;
+                }
+                case Type::Array: {
+                    JSON::JSONArray& a = j.getArray();
+                    startArray(a.length);
+                    for (jsize_t i=0; i<a.length; i++) {
+                        value(a.members[i]);
+                    }
+                    break;
+                }
+                case Type::Object: {
+                    JSONMap& o = j.getObject();
+                    startObject(o.length());
+                    for (JSONMap::Entry& e : o) {
+                        key(e.key, e.length);
+                        value(e.value);
+                    }
+                    break;
+                }
+                default:
+                    printf("Cannot encode custom type as CBOR.\n");
+                    throw std::exception();
+            }
+        }
+    };
+
+    /* CBOR encoding and decoding of JSON values.
+     * Decoding accepts any well-formed CBOR made of the types above: half precision floats, byte strings (as strings),
+     * indefinite length items and tags (which are skipped) are all understood.
+     * Unsigned integers above INT64_MAX wrap around, as with JSON::getUnsigned().
+     */
+    class CBOR {
+        static const jsize_t MAX_DEPTH = 1024;
+        uint8_t* begin;
+        const uint8_t* ptr;
+        const uint8_t* end;
+        Arena* arena;
+        bool insitu;
+        // scratch buffer for strings and keys when copying
+        std::string str;
+
+        CBOR(const uint8_t* data, jsize_t len, Arena* arena, bool insitu) {
+            this->begin = (uint8_t*)data;
+            this->ptr = data;
+            this->end = data + len;
+            this->arena = arena;
+            this->insitu = insitu;
+        }
+
+        [[noreturn]] void error(const char* msg, const uint8_t* at) {
+            throw ParseError(at - begin, msg);
+        }
+        [[noreturn]] void error(const char* msg) {
+            error(msg, ptr);
+        }
+
+        inline void need(jsize_t n) {
+            if ((jsize_t)(end - ptr) < n) {
+                error("unexpected end of input");
+            }
+        }
+        uint64_t readUint(int n) {
+            need(n);
+            uint64_t v = 0;
+            for (int i=0; i<n; i++) {
+                v = (v << 8) | ptr[i];
+            }
+            ptr += n;
+            return v;
+        }
+        // argument of the item whose initial byte was b, setting indefinite for additional info 31
+        uint64_t argument(uint8_t b, bool& indefinite) {
+            uint8_t info = b & 0x1F;
+            indefinite = false;
+            if (info < 24) {
+                return info;
+            } else if (info <= 27) {
+                return readUint(1 << (info - 24));
+            } else if (info == 31) {
+                indefinite = true;
+                return 0;
+            }
+            error("invalid additional information", ptr - 1);
+        }
+        inline uint8_t next() {
+            need(1);
+            return *ptr++;
+        }
+        static jdouble_t half(uint16_t h) {
+            int exp = (h >> 10) & 0x1F;
+            int mant = h & 0x3FF;
+            jdouble_t v;
+            if (exp == 0) {
+                v = ldexp(mant, -24);
+            } else if (exp != 31) {
+                v = ldexp(mant + 1024, exp - 25);
+            } else {
+                v = mant == 0 ? INFINITY : NAN;
+            }
+            return (h & 0x8000) ? -v : v;
+        }
+
+        /* Read a text or byte string with initial byte b.
+           In situ, the string is moved over its own header and NUL-terminated there, so it is never copied elsewhere. */
+        const char* readString(uint8_t b, jsize_t& slen) {
+            const uint8_t* start = ptr - 1;
+            bool indefinite;
+            uint64_t n = argument(b, indefinite);
+            if (!indefinite) {
+                need(n);
+                const uint8_t* s = ptr;
+                ptr += n;
+                slen = n;
+                if (insitu) {
+                    uint8_t* dst = (uint8_t*)start;
+                    memmove(dst, s, n);
+                    dst[n] = 0;
+                    return (const char*)dst;
+                }
+                str.assign((const char*)s, n);
+                return str.c_str();
+            }
+            // chunks of the same major type up to a break
+            uint8_t* dst = (uint8_t*)start;
+            str.clear();
+            slen = 0;
+            while (true) {
+                uint8_t c = next();
+                if (c == 0xFF) {
+                    break;
+                }
+                if ((c >> 5) != (b >> 5)) {
+                    error("invalid chunk in indefinite length string", ptr - 1);
+                }
+                n = argument(c, indefinite);
+                if (indefinite) {
+                    error("nested indefinite length string", ptr - 1);
+                }
+                need(n);
+                if (insitu) {
+                    memmove(dst + slen, ptr, n);
+                } else {
+                    str.append((const char*)ptr, n);
+                }
+                ptr += n;
+                slen += n;
+            }
+            if (insitu) {
+                dst[slen] = 0;
+                return (const char*)dst;
+            }
+            return str.c_str();
+        }
+
+        JSON decode(jsize_t depth) {
+            JSON o;
+            uint8_t b = next();
+            bool indefinite;
+            // tags carry no meaning in the JSON model, skip them in a loop so a run of tags can't exhaust the stack
+            while ((b >> 5) == 6) {
+                argument(b, indefinite);
+                if (indefinite) {
+                    error("invalid additional information", ptr - 1);
+                }
+                b = next();
+            }
+            switch (b >> 5) {
+                case 0:
+                    o.setInteger((jlong_t)argument(b, indefinite));
+                    if (indefinite) {
+                        error("invalid additional information", ptr - 1);
+                    }
+                    break;
+                case 1:
+                    o.setInteger(-1 - (jlong_t)argument(b, indefinite));
+                    if (indefinite) {
+                        error("invalid additional information", ptr - 1);
+                    }
+                    break;
+                case 2:
+                case 3: {
+                    jsize_t slen;
+                    const char* s = readString(b, slen);
+                    if (insitu) {
+                        o.setString(s, false);
+                    } else if (arena != nullptr) {
+                        o.setString(arena->strdup(s, slen), false);
+                    } else {
+                        o.setString(dupcstr(s, slen), true);
+                    }
+                    break;
+                }
+                case 4: {
+                    if (depth >= MAX_DEPTH) {
+                        error("nesting too deep", ptr - 1);
+                    }
+                    uint64_t n = argument(b, indefinite);
+                    if (indefinite) {
+                        // count the members first so the array is allocated once
+                        std::vector<JSON> members;
+                        while (ptr < end && *ptr != 0xFF) {
+                            members.push_back(decode(depth + 1));
+                        }
+                        next();
+                        n = members.size();
+                        JSON::JSONArray* a = arena != nullptr ? arena->create<JSON::JSONArray>(arena, n) : new JSON::JSONArray(n);
+                        for (jsize_t k=0; k<n; k++) {
+                            a->members[k] = std::move(members[k]);
+                        }
+                        a->length = n;
+                        o.setArray(a);
+                        break;
+                    }
+                    // every member takes at least one byte, which bounds the allocation for hostile input
+                    need(n);
+                    JSON::JSONArray* a = arena != nullptr ? arena->create<JSON::JSONArray>(arena, n) : new JSON::JSONArray(n);
+                    o.setArray(a);
+                    for (jsize_t k=0; k<n; k++) {
+                        a->members[k] = decode(depth + 1);
+                    }
+                    a->length = n;
+                    break;
+                }
+                case 5: {
+                    if (depth >= MAX_DEPTH) {
+                        error("nesting too deep", ptr - 1);
+                    }
+                    uint64_t n = argument(b, indefinite);
+                    JSONMap* m = arena != nullptr ? arena->create<JSONMap>(arena) : new JSONMap();
+                    o.setObject(m);
+                    for (uint64_t k=0; indefinite || k<n; k++) {
+                        uint8_t kb = next();
+                        if (indefinite && kb == 0xFF) {
+                            break;
+                        }
+                        if ((kb >> 5) != 3) {
+                            error("object key is not a text string", ptr - 1);
+                        }
+                        jsize_t klen;
+                        const char* key = readString(kb, klen);
+                        // create the slot now, the key buffer is reused while decoding the value
+                        JSON& slot = insitu ? m->getBorrowed(key, klen) : m->get(std::string_view(key, klen));
+                        slot = decode(depth + 1);
+                    }
+                    break;
+                }
+                case 7:
+                    switch (b & 0x1F) {
+                        case 20:
+                            o.setBoolean(false);
+                            break;
+                        case 21:
+                            o.setBoolean(true);
+                            break;
+                        case 22:
+                            o.setNull();
+                            break;
+                        case 23:
+                            break;
+                        case 25:
+                            o.setFloat(half(readUint(2)));
+                            break;
+                        case 26: {
+                            uint32_t bits = readUint(4);
+                            float f;
+                            memcpy(&f, &bits, 4);
+                            o.setFloat(f);
+                            break;
+                        }
+                        case 27: {
+                            uint64_t bits = readUint(8);
+                            jdouble_t d;
+                            memcpy(&d, &bits, 8);
+                            o.setFloat(d);
+                            break;
+                        }
+                        case 31:
+                            error("unexpected break", ptr - 1);
+                        default:
+                            error("unsupported simple value", ptr - 1);
+                    }
+                    break;
+            }
+            return o;
+        }
+
+        JSON decode() {
+            JSON o = decode(0);
+            if (ptr != end) {
+                error("unexpected data after value");
+            }
+            return o;
+        }
+
+        public:
+        /* Encode a JSON value. Returns a buffer allocated with malloc, free it with free(). */
+        static uint8_t* encode(JSON& j, jsize_t& len) {
+            CBORWriter w;
+            w.value(j);
+            len = w.length();
+            return w.release();
+        }
+        /* Encode a JSON value into a CBORWriter. */
+        static void encode(JSON& j, CBORWriter& w) {
+            w.value(j);
+        }
+        /* Decode len bytes of CBOR. Strings are copied, into arena if given. Throws ParseError on invalid input. */
+        static JSON decode(const void* data, jsize_t len, Arena* arena=nullptr) {
+            CBOR d((const uint8_t*)data, len, arena, false);
+            return d.decode();
+        }
+        /* Decode len bytes of CBOR without copying strings.
+           Each string is moved back over its own header and NUL-terminated in place, so data is modified
+           and must outlive the result. Containers are allocated from arena if given. Throws ParseError on invalid input. */
+        static JSON decodeInSitu(void* data, jsize_t len, Arena* arena=nullptr) {
+            CBOR d((const uint8_t*)data, len, arena, true);
+            return d.decode();
+        }
+    };
+}
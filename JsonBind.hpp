@@ -0,0 +1,509 @@
+/* Typed binding between JSON and C++ structs.
+ * A struct declares its fields once by specializing JSON::Binding, and is then parsed straight from the Tokenizer
+ * into its members without building a JSON tree, and serialized straight from its members through a Writer.
+ * Object keys are matched with a perfect hash found at compile time, so each key costs one hash and one compare.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  struct Point { int x; double y; std::string name; std::vector<int> tags; };
+ *  template<> struct JSON::Binding<Point> {
+ *      static constexpr auto fields = std::make_tuple(
+ *          field("x", &Point::x), field("y", &Point::y), field("name", &Point::name), field("tags", &Point::tags));
+ *  };
+ *  Point p = JSON::Bind::parse<Point>("{\"x\": 1, \"y\": 2.5, \"name\": \"a\", \"tags\": [1, 2]}");
+ *  const char* s = JSON::Bind::serialize(p);
+ *  free((void*)s);
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Json.hpp"
+
+namespace JSON {
+    namespace bind {
+        constexpr jsize_t length(const char* s) {
+            jsize_t n = 0;
+            while (s[n] != 0) {
+                n++;
+            }
+            return n;
+        }
+    }
+
+    /* A named member of a bound struct. Construct with JSON::field(). */
+    template<class T, class M>
+    class Field {
+        public:
+        typedef M type;
+        const char* name;
+        jsize_t length;
+        M T::*member;
+        constexpr Field(const char* name, M T::*member) : name(name), length(bind::length(name)), member(member) {}
+    };
+
+    /* Returns a Field binding the JSON object key name to member. */
+    template<class T, class M>
+    constexpr Field<T, M> field(const char* name, M T::*member) {
+        return Field<T, M>(name, member);
+    }
+
+    /* Specialize for a struct with a static constexpr member "fields", a std::tuple of JSON::field()s, to bind it to JSON objects.
+       Keys not listed in fields are skipped when parsing, and members whose keys are missing keep their current values. */
+    template<class T>
+    struct Binding {};
+
+    namespace bind {
+        static const jsize_t MAX_DEPTH = 1024;
+
+        template<class T, class = void>
+        struct isBound : std::false_type {};
+        template<class T>
+        struct isBound<T, std::void_t<decltype(Binding<T>::fields)>> : std::true_type {};
+
+        // FNV-1a with a seed, finished with a mix so the low bits depend on every byte
+        constexpr uint32_t hash(const char* s, jsize_t n, uint32_t seed) {
+            uint32_t h = 2166136261u ^ seed;
+            for (jsize_t i=0; i<n; i++) {
+                h = (h ^ (uint8_t)s[i]) * 16777619u;
+            }
+            h ^= h >> 15;
+            h *= 0x2C1B3C6Du;
+            h ^= h >> 12;
+            return h;
+        }
+
+        class Name {
+            public:
+            const char* s;
+            jsize_t length;
+        };
+
+        // true if seed sends every name to a different slot of a table of size slots
+        template<jsize_t N>
+        constexpr bool separates(const std::array<Name, N>& names, jsize_t size, uint32_t seed) {
+            std::array<jsize_t, N> slots{};
+            for (jsize_t i=0; i<N; i++) {
+                slots[i] = hash(names[i].s, names[i].length, seed) & (size - 1);
+                for (jsize_t j=0; j<i; j++) {
+                    if (slots[j] == slots[i]) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        static const uint32_t MAX_SEEDS = 256;
+
+        // smallest power of two table, at least twice the number of names, that some seed hashes perfectly. 0 if there is none.
+        template<jsize_t N>
+        constexpr jsize_t tableSize(const std::array<Name, N>& names) {
+            jsize_t size = 1;
+            while (size < N * 2) {
+                size *= 2;
+            }
+            for (; size<=65536; size*=2) {
+                for (uint32_t seed=0; seed<MAX_SEEDS; seed++) {
+                    if (separates(names, size, seed)) {
+                        return size;
+                    }
+                }
+            }
+            return 0;
+        }
+        template<jsize_t N>
+        constexpr uint32_t tableSeed(const std::array<Name, N>& names, jsize_t size) {
+            for (uint32_t seed=0; seed<MAX_SEEDS; seed++) {
+                if (separates(names, size, seed)) {
+                    return seed;
+                }
+            }
+            return 0;
+        }
+
+        /* Reads and writes values of type T. Specialize for custom types, with
+             static void read(Tokenizer& t, Tokenizer::Token tok, T& v, jsize_t depth)
+             static void write(Writer& w, const T& v)
+             static bool present(const T& v) returning false to leave a member out of its object. */
+        template<class T, class = void>
+        struct Value {
+            static_assert(isBound<T>::value, "type has no JSON::Binding or JSON::bind::Value specialization");
+        };
+
+        // skip over one value starting at tok, checking that it is well formed
+        static void skip(Tokenizer& t, Tokenizer::Token tok, jsize_t depth) {
+            switch (tok) {
+                case Tokenizer::Null:
+                case Tokenizer::True:
+                case Tokenizer::False:
+                case Tokenizer::Integer:
+                case Tokenizer::Float:
+                case Tokenizer::String:
+                    return;
+                case Tokenizer::BeginArray:
+                    if (depth >= MAX_DEPTH) {
+                        t.error("nesting too deep");
+                    }
+                    tok = t.next();
+                    if (tok == Tokenizer::EndArray) {
+                        return;
+                    }
+                    while (true) {
+                        skip(t, tok, depth + 1);
+                        tok = t.next();
+                        if (tok == Tokenizer::EndArray) {
+                            return;
+                        } else if (tok != Tokenizer::Comma) {
+                            t.error("expected ',' or ']'");
+                        }
+                        tok = t.next();
+                    }
+                case Tokenizer::BeginObject:
+                    if (depth >= MAX_DEPTH) {
+                        t.error("nesting too deep");
+                    }
+                    tok = t.next();
+                    if (tok == Tokenizer::EndObject) {
+                        return;
+                    }
+                    while (true) {
+                        if (tok != Tokenizer::String) {
+                            t.error("expected string key");
+                        }
+                        if (t.next() != Tokenizer::Colon) {
+                            t.error("expected ':'");
+                        }
+                        skip(t, t.next(), depth + 1);
+                        tok = t.next();
+                        if (tok == Tokenizer::EndObject) {
+                            return;
+                        } else if (tok != Tokenizer::Comma) {
+                            t.error("expected ',' or '}'");
+                        }
+                        tok = t.next();
+                    }
+                case Tokenizer::End:
+                    t.error("unexpected end of input");
+                default:
+                    t.error("unexpected token");
+            }
+        }
+
+        template<>
+        struct Value<bool> {
+            static void read(Tokenizer& t, Tokenizer::Token tok, bool& v, jsize_t /*depth*/) {
+                if (tok == Tokenizer::True) {
+                    v = true;
+                } else if (tok == Tokenizer::False) {
+                    v = false;
+                } else {
+                    t.error("expected a boolean");
+                }
+            }
+            static void write(Writer& w, const bool& v) {
+                w.boolean(v);
+            }
+            static bool present(const bool& /*v*/) {
+                return true;
+            }
+        };
+
+        template<class T>
+        struct Value<T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value>> {
+            static void read(Tokenizer& t, Tokenizer::Token tok, T& v, jsize_t /*depth*/) {
+                if (tok != Tokenizer::Integer) {
+                    t.error("expected an integer");
+                }
+                if (std::is_signed<T>::value ? t.i < (jlong_t)std::numeric_limits<T>::min() : t.i < 0) {
+                    t.error("integer out of range");
+                }
+                if (sizeof(T) < sizeof(jlong_t) && t.i > (jlong_t)std::numeric_limits<T>::max()) {
+                    t.error("integer out of range");
+                }
+                v = (T)t.i;
+            }
+            static void write(Writer& w, const T& v) {
+                w.integer((jlong_t)v);
+            }
+            static bool present(const T& /*v*/) {
+                return true;
+            }
+        };
+
+        template<class T>
+        struct Value<T, std::enable_if_t<std::is_floating_point<T>::value>> {
+            static void read(Tokenizer& t, Tokenizer::Token tok, T& v, jsize_t /*depth*/) {
+                if (tok == Tokenizer::Float) {
+                    v = (T)t.d;
+                } else if (tok == Tokenizer::Integer) {
+                    v = (T)t.i;
+                } else {
+                    t.error("expected a number");
+                }
+            }
+            static void write(Writer& w, const T& v) {
+                w.floating((jdouble_t)v);
+            }
+            static bool present(const T& /*v*/) {
+                return true;
+            }
+        };
+
+        template<>
+        struct Value<std::string> {
+            static void read(Tokenizer& t, Tokenizer::Token tok, std::string& v, jsize_t /*depth*/) {
+                if (tok != Tokenizer::String) {
+                    t.error("expected a string");
+                }
+                v.assign(t.s, t.slen);
+            }
+            static void write(Writer& w, const std::string& v) {
+                w.string(v.data(), v.size());
+            }
+            static bool present(const std::string& /*v*/) {
+                return true;
+            }
+        };
+
+        template<class T>
+        struct Value<std::vector<T>> {
+            static void read(Tokenizer& t, Tokenizer::Token tok, std::vector<T>& v, jsize_t depth) {
+                if (tok != Tokenizer::BeginArray) {
+                    t.error("expected an array");
+                }
+                if (depth >= MAX_DEPTH) {
+                    t.error("nesting too deep");
+                }
+                v.clear();
+                tok = t.next();
+                if (tok == Tokenizer::EndArray) {
+                    return;
+                }
+                while (true) {
+                    v.emplace_back();
+                    Value<T>::read(t, tok, v.back(), depth + 1);
+                    tok = t.next();
+                    if (tok == Tokenizer::EndArray) {
+                        return;
+                    } else if (tok != Tokenizer::Comma) {
+                        t.error("expected ',' or ']'");
+                    }
+                    tok = t.next();
+                }
+            }
+            static void write(Writer& w, const std::vector<T>& v) {
+                w.startArray();
+                for (const T& m : v) {
+                    Value<T>::write(w, m);
+                }
+                w.endArray();
+            }
+            static bool present(const std::vector<T>& /*v*/) {
+                return true;
+            }
+        };
+
+        // null or a missing key leaves the optional empty, and empty optionals are left out of their object
+        template<class T>
+        struct Value<std::optional<T>> {
+            static void read(Tokenizer& t, Tokenizer::Token tok, std::optional<T>& v, jsize_t depth) {
+                if (tok == Tokenizer::Null) {
+                    v.reset();
+                } else {
+                    Value<T>::read(t, tok, v.emplace(), depth);
+                }
+            }
+            static void write(Writer& w, const std::optional<T>& v) {
+                if (v.has_value()) {
+                    Value<T>::write(w, *v);
+                } else {
+                    w.null();
+                }
+            }
+            static bool present(const std::optional<T>& v) {
+                return v.has_value();
+            }
+        };
+
+        // any JSON value, for members whose shape isn't fixed
+        template<>
+        struct Value<JSON> {
+            static void read(Tokenizer& t, Tokenizer::Token tok, JSON& v, jsize_t /*depth*/) {
+                v = JSON::deserialize(t, tok);
+            }
+            static void write(Writer& w, const JSON& v) {
+                w.value(const_cast<JSON&>(v));
+            }
+            static bool present(const JSON& v) {
+                return const_cast<JSON&>(v).getType() != Type::Empty;
+            }
+        };
+
+        // structs with a Binding, as objects
+        template<class T>
+        struct Value<T, std::enable_if_t<isBound<T>::value>> {
+            typedef std::decay_t<decltype(Binding<T>::fields)> Fields;
+            static constexpr jsize_t N = std::tuple_size<Fields>::value;
+            typedef void (*Reader)(Tokenizer& t, Tokenizer::Token tok, T& v, jsize_t depth);
+
+            template<jsize_t... I>
+            static constexpr std::array<Name, N> names(std::index_sequence<I...>) {
+                return {{ Name{std::get<I>(Binding<T>::fields).name, std::get<I>(Binding<T>::fields).length}... }};
+            }
+            static constexpr std::array<Name, N> NAMES = names(std::make_index_sequence<N>());
+            static constexpr jsize_t SIZE = tableSize(NAMES);
+            static_assert(SIZE > 0, "JSON::Binding field names must be unique");
+            static constexpr uint32_t SEED = tableSeed(NAMES, SIZE);
+
+            // field index of each hash slot, N for empty slots
+            static constexpr std::array<uint16_t, SIZE> table() {
+                std::array<uint16_t, SIZE> slots{};
+                for (jsize_t i=0; i<SIZE; i++) {
+                    slots[i] = N;
+                }
+                for (jsize_t i=0; i<N; i++) {
+                    slots[hash(NAMES[i].s, NAMES[i].length, SEED) & (SIZE - 1)] = i;
+                }
+                return slots;
+            }
+            static constexpr std::array<uint16_t, SIZE> TABLE = table();
+
+            template<jsize_t I>
+            static void readField(Tokenizer& t, Tokenizer::Token tok, T& v, jsize_t depth) {
+                auto& f = std::get<I>(Binding<T>::fields);
+                Value<typename std::decay_t<decltype(f)>::type>::read(t, tok, v.*(f.member), depth);
+            }
+            template<jsize_t... I>
+            static constexpr std::array<Reader, N> readers(std::index_sequence<I...>) {
+                return {{ &readField<I>... }};
+            }
+            static constexpr std::array<Reader, N> READERS = readers(std::make_index_sequence<N>());
+
+            /* Returns the index of the field named by s, or N if there is none. */
+            static jsize_t lookup(const char* s, jsize_t n) {
+                jsize_t i = TABLE[hash(s, n, SEED) & (SIZE - 1)];
+                if (i < N && NAMES[i].length == n && !memcmp(NAMES[i].s, s, n)) {
+                    return i;
+                }
+                return N;
+            }
+
+            static void read(Tokenizer& t, Tokenizer::Token tok, T& v, jsize_t depth) {
+                if (tok != Tokenizer::BeginObject) {
+                    t.error("expected an object");
+                }
+                if (depth >= MAX_DEPTH) {
+                    t.error("nesting too deep");
+                }
+                tok = t.next();
+                if (tok == Tokenizer::EndObject) {
+                    return;
+                }
+                while (true) {
+                    if (tok != Tokenizer::String) {
+                        t.error("expected string key");
+                    }
+                    // look the key up now, the key buffer is reused while parsing the value
+                    jsize_t i = lookup(t.s, t.slen);
+                    if (t.next() != Tokenizer::Colon) {
+                        t.error("expected ':'");
+                    }
+                    if (i < N) {
+                        READERS[i](t, t.next(), v, depth + 1);
+                    } else {
+                        skip(t, t.next(), depth + 1);
+                    }
+                    tok = t.next();
+                    if (tok == Tokenizer::EndObject) {
+                        return;
+                    } else if (tok != Tokenizer::Comma) {
+                        t.error("expected ',' or '}'");
+                    }
+                    tok = t.next();
+                }
+            }
+
+            template<jsize_t I>
+            static void writeField(Writer& w, const T& v) {
+                auto& f = std::get<I>(Binding<T>::fields);
+                typedef Value<typename std::decay_t<decltype(f)>::type> V;
+                if (V::present(v.*(f.member))) {
+                    w.key(f.name, f.length);
+                    V::write(w, v.*(f.member));
+                }
+            }
+            template<jsize_t... I>
+            static void writeFields(Writer& w, const T& v, std::index_sequence<I...>) {
+                (writeField<I>(w, v), ...);
+            }
+            static void write(Writer& w, const T& v) {
+                w.startObject();
+                writeFields(w, v, std::make_index_sequence<N>());
+                w.endObject();
+            }
+            static bool present(const T& /*v*/) {
+                return true;
+            }
+        };
+    }
+
+    /* Parses JSON into bound types and serializes them, see JSON::Binding.
+       Booleans, integer and floating point types, std::string, std::vector, std::optional and JSON members are supported,
+       other types can be added by specializing JSON::bind::Value. */
+    class Bind {
+        public:
+        /* Parse len bytes of JSON into v. Throws ParseError on invalid input, or if the input doesn't match the type. */
+        template<class T>
+        static void parse(const char* data, jsize_t len, T& v) {
+            Tokenizer t(data, len);
+            bind::Value<T>::read(t, t.next(), v, 0);
+            if (t.next() != Tokenizer::End) {
+                t.error("unexpected data after document");
+            }
+        }
+        template<class T>
+        static T parse(const char* data, jsize_t len) {
+            T v{};
+            parse(data, len, v);
+            return v;
+        }
+        template<class T>
+        static T parse(const char* data) {
+            return parse<T>(data, strlen(data));
+        }
+        template<class T>
+        static T parse(const std::string& s) {
+            return parse<T>(s.data(), s.size());
+        }
+
+        /* Read one value of type T starting at token tok, leaving t just after it. */
+        template<class T>
+        static void read(Tokenizer& t, Tokenizer::Token tok, T& v) {
+            bind::Value<T>::read(t, tok, v, 0);
+        }
+
+        /* Write v into a Writer. */
+        template<class T>
+        static void write(Writer& w, const T& v) {
+            bind::Value<T>::write(w, v);
+        }
+        /* Serialize v. Returns a string allocated with malloc, free it with free(). */
+        template<class T>
+        static const char* serialize(const T& v, bool pretty=false) {
+            Writer w(pretty);
+            bind::Value<T>::write(w, v);
+            return w.release();
+        }
+    };
+}
@@ -0,0 +1,480 @@
+/* Lazy on-demand JSON access.
+ * Building a LazyDocument only records the offsets of the structural characters ({}[]:,) outside strings,
+ * found 64 bytes at a time with the kernels in JsonScan.hpp, together with the matching close bracket of every container.
+ * Values are decoded only when an accessor is called on them, and unneeded subtrees are skipped in O(1) using the index.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  JSON::LazyDocument doc(data, len);
+ *  long long id = doc.root()["user"]["id"].getInteger();
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Json.hpp"
+#include "JsonScan.hpp"
+
+namespace JSON {
+    class LazyValue;
+
+    /* Structural index over a JSON document. The input data is not copied and must outlive the LazyDocument.
+     * Indexing checks the brackets, string boundaries, the order of ':' and ',' separators, that every member and element has a value
+     * and that object keys are quoted. Values themselves are validated when they are decoded. */
+    class LazyDocument {
+        friend class LazyValue;
+        class Entry {
+            public:
+            // byte offset of the structural character
+            uint32_t pos;
+            // for '{' and '[', the entry number of the matching close bracket
+            uint32_t match;
+        };
+        const char* data;
+        jsize_t len;
+        std::vector<Entry> index;
+
+        [[noreturn]] void error(const char* msg, jsize_t at) {
+            throw ParseError(data, at, msg);
+        }
+
+        void build() {
+            if (len >= UINT32_MAX) {
+                printf("JSON::LazyDocument input too large (max 4GB)\n");
+                throw std::exception();
+            }
+            const scan::Kernels& kernels = scan::kernels();
+            index.clear();
+            index.reserve(len / 8);
+            std::vector<uint32_t> open;
+            // the last '{', '[', ':' or ',' of each open container
+            std::vector<char> sep;
+            // the innermost open bracket and the last structural character, 0 if there is none
+            char top = 0;
+            char prev = 0;
+            jsize_t from = 0;
+            // all ones if the previous block ended inside a string
+            uint64_t instringCarry = 0;
+            // set if the first byte of the next block is escaped by a backslash
+            uint64_t escapedCarry = 0;
+            char tail[64];
+            for (jsize_t base=0; base<len; base+=64) {
+                const char* p = data + base;
+                if (len - base < 64) {
+                    memset(tail, ' ', 64);
+                    memcpy(tail, p, len - base);
+                    p = tail;
+                }
+                scan::Block b;
+                kernels.classify(p, b);
+                uint64_t escaped = escapedCarry;
+                escapedCarry = 0;
+                // backslashes are rare, so walk them one at a time
+                for (uint64_t bs = b.backslash; bs != 0; bs &= bs - 1) {
+                    int i = scan::ctz(bs);
+                    if ((escaped >> i) & 1) {
+                        continue;
+                    }
+                    if (i == 63) {
+                        escapedCarry = 1;
+                    } else {
+                        escaped |= 1ull << (i + 1);
+                    }
+                }
+                // prefix xor of the unescaped quotes gives the bytes inside strings
+                uint64_t m = b.quote & ~escaped;
+                m ^= m << 1;
+                m ^= m << 2;
+                m ^= m << 4;
+                m ^= m << 8;
+                m ^= m << 16;
+                m ^= m << 32;
+                uint64_t instring = m ^ instringCarry;
+                instringCarry = (uint64_t)((int64_t)instring >> 63);
+                for (uint64_t s = b.structural & ~instring; s != 0; s &= s - 1) {
+                    uint32_t off = base + scan::ctz(s);
+                    uint32_t e = index.size();
+                    char c = data[off];
+                    // a scalar, or a container that just closed, lies between the previous structural character and c
+                    bool value = prev == '}' || prev == ']' || (from < off && (!scan::isspace(data[from]) || skipspace(from) < off));
+                    check(c, off, from, value, top, sep.empty() ? 0 : sep.back());
+                    index.push_back({off, 0});
+                    if (c == '{' || c == '[') {
+                        open.push_back(e);
+                        sep.push_back(c);
+                        top = c;
+                    } else if (c == '}' || c == ']') {
+                        index[open.back()].match = e;
+                        open.pop_back();
+                        sep.pop_back();
+                        top = open.empty() ? 0 : data[index[open.back()].pos];
+                    } else {
+                        sep.back() = c;
+                    }
+                    prev = c;
+                    from = off + 1;
+                }
+            }
+            if (instringCarry) {
+                error("unterminated string", len);
+            }
+            if (!open.empty()) {
+                error("unexpected end of input", len);
+            }
+        }
+
+        // check that structural character c at off may follow the entries indexed so far. from is the offset after the previous one,
+        // value is set if a value lies between them, top is the innermost open bracket and last the separator before c in that container
+        inline void check(char c, jsize_t off, jsize_t from, bool value, char top, char last) {
+            switch (c) {
+                case '{':
+                case '[':
+                    if (value || (top == 0 ? !index.empty() : top == '{' ? last != ':' : last == ':')) {
+                        error(c == '{' ? "unexpected '{'" : "unexpected '['", off);
+                    }
+                    break;
+                case ':': {
+                    if (top != '{' || last == ':') {
+                        error("unexpected ':'", off);
+                    }
+                    // the key must be a string, which keyEquals relies on
+                    jsize_t key = skipspace(from);
+                    jsize_t end = off;
+                    while (end > key && scan::isspace(data[end - 1])) {
+                        end--;
+                    }
+                    if (!value || data[key] != '"' || end - key < 2 || data[end - 1] != '"') {
+                        error("expected string key", key);
+                    }
+                    break;
+                }
+                case ',':
+                    if (top == 0 || (top == '{' && last != ':')) {
+                        error("unexpected ','", off);
+                    }
+                    if (!value) {
+                        error("expected value", off);
+                    }
+                    break;
+                default:
+                    if (top != (c == '}' ? '{' : '[')) {
+                        error(c == '}' ? "unexpected '}'" : "unexpected ']'", off);
+                    }
+                    // empty containers close right after opening, otherwise the last member needs a value
+                    if (value ? top == '{' && last != ':' : last != top) {
+                        error(value ? "expected ':'" : "expected value", off);
+                    }
+                    break;
+            }
+        }
+
+        // offset of the structural character at entry k, or the end of input past the last entry
+        inline jsize_t at(jsize_t k) {
+            return k < index.size() ? index[k].pos : len;
+        }
+        inline jsize_t skipspace(jsize_t off) {
+            while (off < len && scan::isspace(data[off])) {
+                off++;
+            }
+            return off;
+        }
+
+        public:
+        /* Index a NUL-terminated JSON document. Throws ParseError if the structure is invalid. */
+        LazyDocument(const char* data) : LazyDocument(data, strlen(data)) {}
+        /* Index len bytes of JSON. Throws ParseError if the structure is invalid. */
+        LazyDocument(const char* data, jsize_t len) {
+            this->data = data;
+            this->len = len;
+            build();
+        }
+        /* Returns the number of structural characters in the index. */
+        inline jsize_t indexLength() {
+            return index.size();
+        }
+        /* Returns the root value. */
+        LazyValue root();
+    };
+
+    /* A value in a LazyDocument. Decoding happens when an accessor is called.
+     * A LazyValue is only valid as long as its LazyDocument. Missing keys and out of range indices give an Empty value. */
+    class LazyValue {
+        LazyDocument* doc;
+        // byte offset of the first character of the value
+        jsize_t off;
+        // first index entry at or after off: the value's open bracket for containers, its terminator otherwise
+        jsize_t k;
+
+        void type_error() {
+            printf("Wrong type (0x%X) for operation\n", (unsigned int)getType());
+            throw std::exception();
+        }
+        inline bool isContainer() {
+            return doc != nullptr && k < doc->index.size() && doc->index[k].pos == off
+                && (doc->data[off] == '{' || doc->data[off] == '[');
+        }
+        // entry number of the separator (',' or close bracket) following this value
+        inline jsize_t after() {
+            return isContainer() ? doc->index[k].match + 1 : k;
+        }
+        // the value that starts after the structural character at entry e
+        inline LazyValue following(jsize_t e) {
+            return LazyValue(doc, doc->skipspace(doc->index[e].pos + 1), e + 1);
+        }
+        // decode a scalar with the Tokenizer
+        Tokenizer::Token scalar(Tokenizer& t) {
+            Tokenizer::Token tok = t.next();
+            if (t.next() != Tokenizer::End) {
+                t.error("unexpected data after value");
+            }
+            return tok;
+        }
+        bool keyEquals(const char* key, jsize_t keylen) {
+            // the key string runs from off to the last quote before the ':' at entry k
+            jsize_t q = doc->index[k].pos;
+            while (q > off && doc->data[q] != '"') {
+                q--;
+            }
+            // the index only accepts quoted keys, this guards against a value that isn't a key
+            if (doc->data[off] != '"' || q <= off) {
+                throw ParseError(doc->data, off, "expected string key");
+            }
+            const char* raw = doc->data + off + 1;
+            jsize_t rawlen = q - off - 1;
+            if (memchr(raw, '\\', rawlen) == nullptr) {
+                return rawlen == keylen && !memcmp(raw, key, keylen);
+            }
+            Tokenizer t(doc->data + off, q + 1 - off);
+            t.next();
+            return t.slen == keylen && !memcmp(t.s, key, keylen);
+        }
+
+        public:
+        LazyValue() {
+            doc = nullptr;
+            off = k = 0;
+        }
+        LazyValue(LazyDocument* doc, jsize_t off, jsize_t k) {
+            this->doc = doc;
+            this->off = off;
+            this->k = k;
+        }
+
+        /* Iterates over the members of an array or object. */
+        class Iterator {
+            LazyDocument* doc;
+            // entry of the container's open bracket
+            jsize_t open;
+            // entry of the structural character before the current member ('[', '{' or ',')
+            jsize_t e;
+            public:
+            Iterator(LazyDocument* doc, jsize_t open, jsize_t e) {
+                this->doc = doc;
+                this->open = open;
+                this->e = e;
+            }
+            /* Returns the key of the current object member. */
+            std::string key() {
+                return LazyValue(doc, doc->skipspace(doc->index[e].pos + 1), e + 1).getString();
+            }
+            /* Returns the current member's value. */
+            LazyValue operator*() {
+                LazyValue v(doc, doc->skipspace(doc->index[e].pos + 1), e + 1);
+                if (doc->data[doc->index[open].pos] == '{') {
+                    return v.following(v.k);
+                }
+                return v;
+            }
+            Iterator& operator++() {
+                jsize_t close = doc->index[open].match;
+                e = (**this).after();
+                if (e >= close || doc->data[doc->index[e].pos] != ',') {
+                    e = close;
+                }
+                return *this;
+            }
+            bool operator!=(const Iterator& o) {
+                return e != o.e;
+            }
+        };
+
+        Iterator begin() {
+            if (!isContainer()) {
+                type_error();
+            }
+            // an empty container's close bracket is the very next entry
+            if (doc->index[k].match == k + 1) {
+                return end();
+            }
+            return Iterator(doc, k, k);
+        }
+        Iterator end() {
+            if (!isContainer()) {
+                type_error();
+            }
+            return Iterator(doc, k, doc->index[k].match);
+        }
+
+        Type getType() {
+            if (doc == nullptr || off >= doc->len) {
+                return Type::Empty;
+            }
+            switch (doc->data[off]) {
+                case '{':
+                    return Type::Object;
+                case '[':
+                    return Type::Array;
+                case '"':
+                    return Type::String;
+                case 't':
+                case 'f':
+                    return Type::Boolean;
+                case 'n':
+                    return Type::Null;
+                default:
+                    break;
+            }
+            // numbers are only told apart by decoding them
+            Tokenizer t(doc->data + off, doc->at(k) - off);
+            return t.next() == Tokenizer::Integer ? Type::Integer : Type::Float;
+        }
+        inline bool isEmpty() {
+            return getType() == Type::Empty;
+        }
+        bool isNull() {
+            return getType() == Type::Null;
+        }
+
+        /* Look up an object member. Members that are not needed are skipped without being decoded. */
+        LazyValue operator[](const char* key) {
+            return get(key, strlen(key));
+        }
+        LazyValue operator[](std::string key) {
+            return get(key.c_str(), key.length());
+        }
+        LazyValue get(const char* key, jsize_t keylen) {
+            if (getType() != Type::Object) {
+                printf("Cannot index non-object with key string\n");
+                throw std::exception();
+            }
+            jsize_t close = doc->index[k].match;
+            jsize_t e = k;
+            while (e + 1 < close) {
+                // entry e+1 is the ':' after the key
+                LazyValue name(doc, doc->skipspace(doc->index[e].pos + 1), e + 1);
+                LazyValue value = following(e + 1);
+                if (name.keyEquals(key, keylen)) {
+                    return value;
+                }
+                e = value.after();
+            }
+            return LazyValue();
+        }
+        bool contains(const char* key) {
+            return getType() == Type::Object && !get(key, strlen(key)).isEmpty();
+        }
+        bool contains(std::string key) {
+            return contains(key.c_str());
+        }
+        /* Get an array member by index. Members before it are skipped in O(1) each. */
+        LazyValue operator[](jsize_t i) {
+            if (getType() != Type::Array) {
+                type_error();
+            }
+            for (Iterator it = begin(); it != end(); ++it) {
+                if (i-- == 0) {
+                    return *it;
+                }
+            }
+            return LazyValue();
+        }
+        jsize_t getArrayLength() {
+            if (getType() != Type::Array) {
+                type_error();
+            }
+            jsize_t n = 0;
+            for (Iterator it = begin(); it != end(); ++it) {
+                n++;
+            }
+            return n;
+        }
+        jsize_t getObjectLength() {
+            if (getType() != Type::Object) {
+                type_error();
+            }
+            jsize_t n = 0;
+            for (Iterator it = begin(); it != end(); ++it) {
+                n++;
+            }
+            return n;
+        }
+
+        std::string getString() {
+            if (getType() != Type::String) {
+                type_error();
+            }
+            Tokenizer t(doc->data + off, doc->at(k) - off);
+            scalar(t);
+            return std::string(t.s, t.slen);
+        }
+        jlong_t getInteger() {
+            Tokenizer t(doc->data + off, doc->at(k) - off);
+            if (scalar(t) != Tokenizer::Integer) {
+                type_error();
+            }
+            return t.i;
+        }
+        jsize_t getUnsigned() {
+            return getInteger();
+        }
+        jdouble_t getFloat() {
+            Tokenizer t(doc->data + off, doc->at(k) - off);
+            if (scalar(t) != Tokenizer::Float) {
+                type_error();
+            }
+            return t.d;
+        }
+        jdouble_t getNumber() {
+            Tokenizer t(doc->data + off, doc->at(k) - off);
+            Tokenizer::Token tok = scalar(t);
+            if (tok == Tokenizer::Integer) {
+                return t.i;
+            } else if (tok != Tokenizer::Float) {
+                type_error();
+            }
+            return t.d;
+        }
+        bool getBoolean() {
+            Tokenizer t(doc->data + off, doc->at(k) - off);
+            Tokenizer::Token tok = scalar(t);
+            if (tok != Tokenizer::True && tok != Tokenizer::False) {
+                type_error();
+            }
+            return tok == Tokenizer::True;
+        }
+
+        /* Returns the raw JSON text of this value. */
+        std::string getRaw() {
+            if (doc == nullptr) {
+                return std::string();
+            }
+            jsize_t end = isContainer() ? doc->index[doc->index[k].match].pos + 1 : doc->at(k);
+            while (end > off && scan::isspace(doc->data[end - 1])) {
+                end--;
+            }
+            return std::string(doc->data + off, end - off);
+        }
+        /* Fully parse this value into a JSON tree. */
+        JSON materialize() {
+            std::string raw = getRaw();
+            return JSON::deserialize(raw.c_str(), raw.length());
+        }
+    };
+
+    inline LazyValue LazyDocument::root() {
+        return LazyValue(this, skipspace(0), 0);
+    }
+}
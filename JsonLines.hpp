@@ -0,0 +1,333 @@
+/* Parallel newline-delimited JSON (NDJSON / JSON Lines) reader.
+ * Input is split into chunks at line boundaries and the chunks are parsed on a pool of worker threads,
+ * each allocating its records from its own Arena. Records are returned in input order.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  JSON::NDJSONReader reader;
+ *  JSON::NDJSONBatch batch = reader.parse(data, len);
+ *  for (JSON::jsize_t i=0; i<batch.length(); i++) {
+ *      long long id = batch[i][std::string("id")].getInteger();
+ *  }
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "Arena.hpp"
+#include "Json.hpp"
+#include "JsonScan.hpp"
+
+namespace JSON {
+    /* The records parsed from a block of NDJSON, in input order.
+     * Records are allocated from one Arena per worker thread, which are freed together with the batch.
+     */
+    class NDJSONBatch {
+        friend class NDJSONReader;
+        std::vector<Arena> arenas;
+        std::vector<JSON> records;
+        // 1-based input line of each record
+        std::vector<jsize_t> lines;
+
+        public:
+        NDJSONBatch() {}
+        NDJSONBatch(const NDJSONBatch&) = delete;
+        NDJSONBatch& operator=(const NDJSONBatch&) = delete;
+        NDJSONBatch(NDJSONBatch&&) = default;
+        NDJSONBatch& operator=(NDJSONBatch&&) = default;
+
+        /* Returns the number of records. Blank lines are not counted. */
+        inline jsize_t length() {
+            return records.size();
+        }
+        inline JSON& operator[](jsize_t i) {
+            return records[i];
+        }
+        /* Returns the input line number (starting at 1) that record i was parsed from. */
+        inline jsize_t lineNumber(jsize_t i) {
+            return lines[i];
+        }
+        inline JSON* begin() {
+            return records.data();
+        }
+        inline JSON* end() {
+            return records.data() + records.size();
+        }
+        /* Returns the number of Arena bytes used by the records. */
+        size_t bytesUsed() {
+            size_t n = 0;
+            for (Arena& a : arenas) {
+                n += a.bytesUsed();
+            }
+            return n;
+        }
+        /* Free all records. */
+        void clear() {
+            records.clear();
+            lines.clear();
+            for (Arena& a : arenas) {
+                a.release();
+            }
+        }
+    };
+
+    /* Parses NDJSON on a pool of worker threads.
+     * Each non-blank line must hold one complete JSON value. Lines may end in "\n" or "\r\n".
+     * A ParseError reports the line and column within the whole input, the first failing line wins.
+     */
+    class NDJSONReader {
+        // a run of whole lines parsed by one worker
+        class Chunk {
+            public:
+            const char* begin;
+            const char* end;
+            std::vector<JSON> records;
+            // line of each record, relative to the start of the chunk
+            std::vector<jsize_t> lines;
+            // number of lines in the chunk
+            jsize_t count = 0;
+            unsigned worker = 0;
+            std::exception_ptr exception;
+            // set instead of exception for parse errors, so the position can be made absolute
+            bool failed = false;
+            jsize_t errline = 0;
+            const char* errstart = nullptr;
+            jsize_t errcolumn = 0;
+            char reason[96];
+        };
+        unsigned threads;
+        jsize_t window;
+        // offset and line number of the data passed to the next parse
+        jsize_t baseoffset = 0;
+        jsize_t baseline = 0;
+
+        void parseChunk(Chunk& c, Arena& arena, const scan::Kernels& kernels) {
+            const char* p = c.begin;
+            while (p < c.end) {
+                const char* nl = (const char*) memchr(p, '\n', c.end - p);
+                if (nl == nullptr) {
+                    nl = c.end;
+                }
+                c.count++;
+                if (kernels.space(p, nl) != nl) {
+                    try {
+                        c.records.push_back(JSON::deserialize(p, nl - p, &arena));
+                        c.lines.push_back(c.count);
+                    } catch (ParseError& e) {
+                        c.failed = true;
+                        c.errline = c.count;
+                        c.errstart = p;
+                        c.errcolumn = e.column;
+                        memcpy(c.reason, e.reason, sizeof(c.reason));
+                        return;
+                    }
+                }
+                p = nl + 1;
+            }
+        }
+
+        // split [data, data+len) into chunks of whole lines, about size bytes each
+        void split(const char* data, jsize_t len, jsize_t size, std::vector<Chunk>& chunks) {
+            const char* p = data;
+            const char* end = data + len;
+            while (p < end) {
+                const char* e = end;
+                if ((jsize_t)(end - p) > size) {
+                    e = (const char*) memchr(p + size, '\n', end - p - size);
+                    e = e == nullptr ? end : e + 1;
+                }
+                chunks.emplace_back();
+                chunks.back().begin = p;
+                chunks.back().end = e;
+                p = e;
+            }
+        }
+
+        // parse every chunk, handing them out to the workers in order
+        void run(std::vector<Chunk>& chunks, std::vector<Arena>& arenas) {
+            const scan::Kernels& kernels = scan::kernels();
+            std::atomic<size_t> next(0);
+            auto work = [&](unsigned w) {
+                size_t i;
+                while ((i = next.fetch_add(1)) < chunks.size()) {
+                    chunks[i].worker = w;
+                    try {
+                        parseChunk(chunks[i], arenas[w], kernels);
+                    } catch (...) {
+                        chunks[i].exception = std::current_exception();
+                    }
+                }
+            };
+            unsigned n = chunks.size() < threads ? chunks.size() : threads;
+            if (n <= 1) {
+                work(0);
+                return;
+            }
+            std::vector<std::thread> pool;
+            pool.reserve(n - 1);
+            for (unsigned w=1; w<n; w++) {
+                pool.emplace_back(work, w);
+            }
+            work(0);
+            for (std::thread& t : pool) {
+                t.join();
+            }
+        }
+
+        // parse one window of whole lines into batch, appending to its records
+        void parseWindow(const char* data, jsize_t len, NDJSONBatch& batch) {
+            if (batch.arenas.size() < threads) {
+                batch.arenas.resize(threads);
+            }
+            // several chunks per thread so one slow chunk doesn't leave the others idle
+            jsize_t size = len / (threads * 8);
+            if (size < 64 * 1024) {
+                size = 64 * 1024;
+            }
+            std::vector<Chunk> chunks;
+            split(data, len, size, chunks);
+            run(chunks, batch.arenas);
+            jsize_t line = baseline;
+            for (Chunk& c : chunks) {
+                // records before an error are kept, so callers can still use them
+                for (jsize_t i=0; i<c.records.size(); i++) {
+                    batch.records.push_back(std::move(c.records[i]));
+                    batch.lines.push_back(line + c.lines[i]);
+                }
+                if (c.exception) {
+                    std::rethrow_exception(c.exception);
+                }
+                if (c.failed) {
+                    throw ParseError(baseoffset + (c.errstart - data) + c.errcolumn - 1, line + c.errline, c.errcolumn, c.reason);
+                }
+                line += c.count;
+            }
+            baseoffset += len;
+            baseline = line;
+        }
+
+        // end of the last complete line in [data, data+len), or data if there is none
+        static const char* lastLine(const char* data, jsize_t len) {
+            const char* p = data + len;
+            while (p > data && p[-1] != '\n') {
+                p--;
+            }
+            return p;
+        }
+
+        public:
+        /* Construct a reader using threads workers (0 for one per hardware thread).
+           Callback parsing works through the input window bytes at a time. */
+        NDJSONReader(unsigned threads=0, jsize_t window=64*1024*1024) {
+            if (threads == 0) {
+                threads = std::thread::hardware_concurrency();
+            }
+            this->threads = threads == 0 ? 1 : threads;
+            this->window = window < 1024 ? 1024 : window;
+        }
+
+        /* Parse len bytes of NDJSON, returning all records in input order. Throws ParseError on invalid input.
+           Strings are copied, so data may be freed afterwards. */
+        NDJSONBatch parse(const char* data, jsize_t len) {
+            NDJSONBatch batch;
+            baseoffset = baseline = 0;
+            parseWindow(data, len, batch);
+            return batch;
+        }
+        NDJSONBatch parse(const char* data) {
+            return parse(data, strlen(data));
+        }
+
+        /* Parse len bytes of NDJSON, calling callback with each record and its line number in input order, on the calling thread.
+           Records are only valid during the callback. Memory use is bounded by the window size.
+           Returns the number of records. Throws ParseError on invalid input, after delivering the records before it. */
+        jsize_t parse(const char* data, jsize_t len, std::function<void(JSON& record, jsize_t line)> callback) {
+            NDJSONBatch batch;
+            jsize_t count = 0;
+            const char* end = data + len;
+            baseoffset = baseline = 0;
+            while (data < end) {
+                const char* e = end;
+                if ((jsize_t)(end - data) > window) {
+                    e = (const char*) memchr(data + window, '\n', end - data - window);
+                    e = e == nullptr ? end : e + 1;
+                }
+                count += deliver(data, e - data, batch, callback);
+                data = e;
+            }
+            return count;
+        }
+
+        /* Read NDJSON from fd until end of file, calling callback with each record and its line number in input order.
+           Records are only valid during the callback. Returns the number of records. Throws ParseError on invalid input. */
+        jsize_t parse(FILE* fd, std::function<void(JSON& record, jsize_t line)> callback) {
+            NDJSONBatch batch;
+            jsize_t count = 0;
+            jsize_t allocated = window;
+            jsize_t len = 0;
+            char* buf = (char*) malloc(allocated);
+            if (buf == nullptr) {
+                printf("JSON::NDJSONReader out of memory\n");
+                throw std::exception();
+            }
+            baseoffset = baseline = 0;
+            try {
+                while (true) {
+                    jsize_t n = fread(buf + len, 1, allocated - len, fd);
+                    len += n;
+                    bool eof = n == 0;
+                    const char* e = eof ? buf + len : lastLine(buf, len);
+                    if (e == buf && !eof) {
+                        // a single line longer than the buffer
+                        if (len == allocated) {
+                            char* b = (char*) realloc(buf, allocated * 2);
+                            if (b == nullptr) {
+                                printf("JSON::NDJSONReader out of memory\n");
+                                throw std::exception();
+                            }
+                            buf = b;
+                            allocated *= 2;
+                        }
+                        continue;
+                    }
+                    count += deliver(buf, e - buf, batch, callback);
+                    len -= e - buf;
+                    memmove(buf, e, len);
+                    if (eof) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                free(buf);
+                throw;
+            }
+            free(buf);
+            return count;
+        }
+
+        private:
+        jsize_t deliver(const char* data, jsize_t len, NDJSONBatch& batch, std::function<void(JSON& record, jsize_t line)>& callback) {
+            batch.clear();
+            std::exception_ptr error;
+            try {
+                parseWindow(data, len, batch);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            for (jsize_t i=0; i<batch.length(); i++) {
+                callback(batch.records[i], batch.lines[i]);
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            return batch.length();
+        }
+    };
+}
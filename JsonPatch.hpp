@@ -0,0 +1,426 @@
+/* JSON Patch (RFC 6902), JSON Merge Patch (RFC 7396) and diff for JSON trees.
+ * Patches are applied in place, so an update costs time in proportion to the nodes it touches, not the size of the document.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  JSON::JSON doc = JSON::deserialize("{\"a\": 1}");
+ *  JSON::JSON ops = JSON::deserialize("[{\"op\": \"add\", \"path\": \"/b\", \"value\": [1, 2]}]");
+ *  JSON::Patch::apply(doc, ops);
+ *  JSON::JSON back = JSON::Patch::diff(doc, original);
+ */
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Json.hpp"
+#include "JsonPath.hpp"
+
+namespace JSON {
+    /* Static functions for creating and applying patches. */
+    class Patch {
+        typedef std::vector<Path::Step> Steps;
+
+        // an operation that undoes part of a patch, so a failed patch leaves the document unchanged
+        class Undo {
+            public:
+            enum Kind {
+                Add,
+                Remove,
+                Replace,
+            };
+            Kind kind;
+            Steps steps;
+            JSON value;
+            // for Add, take the value most recently displaced by a Remove or Replace instead, which undoes a move
+            bool displaced = false;
+        };
+
+        [[noreturn]] static void error(const char* msg, const char* path) {
+            printf("JSON Patch failed at \"%s\": %s\n", path, msg);
+            throw std::exception();
+        }
+
+        // the value at the first n steps, or nullptr
+        static JSON* resolve(JSON& root, const Steps& steps, jsize_t n) {
+            JSON* v = &root;
+            for (jsize_t i=0; i<n && v != nullptr; i++) {
+                JSON* next = nullptr;
+                Path::apply(steps[i], *v, [&](JSON& c) {
+                    next = &c;
+                });
+                v = next;
+            }
+            return v;
+        }
+        // the array index addressed by the last step, len for "-", or -1 if it isn't one
+        static jlong_t index(const Path::Step& s, jsize_t len) {
+            if (s.key == "-") {
+                return len;
+            }
+            return s.index;
+        }
+
+        /* Add value at steps, moving it only once nothing can fail.
+           Returns true if an object member or the root was replaced, moving the old value into old.
+           An index of "-" in steps is replaced by the index used, so steps can be used to undo the add. */
+        static bool addAt(JSON& root, Steps& steps, JSON& value, JSON& old, const char* path) {
+            if (steps.empty()) {
+                old = std::move(root);
+                root = std::move(value);
+                return true;
+            }
+            JSON* parent = resolve(root, steps, steps.size() - 1);
+            Path::Step& last = steps.back();
+            if (parent == nullptr) {
+                error("parent does not exist", path);
+            } else if (parent->getType() == Type::Object) {
+                JSONMap& o = parent->getObject();
+                JSON* existing = o.find(last.key.c_str(), last.hash);
+                if (existing != nullptr) {
+                    old = std::move(*existing);
+                    *existing = std::move(value);
+                    return true;
+                }
+                o.get(last.key.c_str()) = std::move(value);
+            } else if (parent->getType() == Type::Array) {
+                JSON::JSONArray& a = parent->getArray();
+                jlong_t i = index(last, a.length);
+                if (i < 0 || (jsize_t)i > a.length) {
+                    error("array index out of range", path);
+                }
+                a.insert(i, std::move(value));
+                last.key = std::to_string(i);
+                last.index = i;
+            } else {
+                error("parent is not an object or array", path);
+            }
+            return false;
+        }
+        /* Remove and return the value at steps. */
+        static JSON removeAt(JSON& root, Steps& steps, const char* path) {
+            if (steps.empty()) {
+                error("cannot remove the root", path);
+            }
+            JSON* parent = resolve(root, steps, steps.size() - 1);
+            Path::Step& last = steps.back();
+            JSON old;
+            if (parent != nullptr && parent->getType() == Type::Object) {
+                JSON* existing = parent->getObject().find(last.key.c_str(), last.hash);
+                if (existing == nullptr) {
+                    error("member does not exist", path);
+                }
+                old = std::move(*existing);
+                parent->getObject().remove(last.key.c_str());
+            } else if (parent != nullptr && parent->getType() == Type::Array) {
+                JSON::JSONArray& a = parent->getArray();
+                if (last.index < 0 || (jsize_t)last.index >= a.length) {
+                    error("array index out of range", path);
+                }
+                old = std::move(a.members[last.index]);
+                a.remove(last.index);
+            } else {
+                error("value does not exist", path);
+            }
+            return old;
+        }
+        /* Replace the value at steps, returning the old value. */
+        static JSON replaceAt(JSON& root, Steps& steps, JSON& value, const char* path) {
+            JSON* v = resolve(root, steps, steps.size());
+            if (v == nullptr) {
+                error("value does not exist", path);
+            }
+            JSON old = std::move(*v);
+            *v = std::move(value);
+            return old;
+        }
+        // add value at steps, recording how to undo it
+        static void add(JSON& root, Steps& steps, JSON& value, std::vector<Undo>& undo, const char* path) {
+            JSON old;
+            if (addAt(root, steps, value, old, path)) {
+                undo.push_back({Undo::Replace, steps, std::move(old)});
+            } else {
+                undo.push_back({Undo::Remove, steps, JSON()});
+            }
+        }
+        static void rollback(JSON& doc, std::vector<Undo>& undo) {
+            // values displaced while undoing, for the Add that undoes a move
+            std::vector<JSON> limbo;
+            for (jsize_t i=undo.size(); i>0; i--) {
+                Undo& u = undo[i-1];
+                JSON old;
+                switch (u.kind) {
+                    case Undo::Add:
+                        if (u.displaced) {
+                            u.value = std::move(limbo.back());
+                            limbo.pop_back();
+                        }
+                        addAt(doc, u.steps, u.value, old, "");
+                        break;
+                    case Undo::Remove:
+                        limbo.push_back(removeAt(doc, u.steps, ""));
+                        break;
+                    case Undo::Replace:
+                        if (u.steps.empty()) {
+                            limbo.push_back(std::move(doc));
+                            doc = std::move(u.value);
+                        } else {
+                            limbo.push_back(replaceAt(doc, u.steps, u.value, ""));
+                        }
+                        break;
+                }
+            }
+        }
+        static const char* member(JSON& op, const char* key, bool required=true) {
+            JSON* v = op.getType() == Type::Object ? op.getObject().find(key) : nullptr;
+            if (v == nullptr || v->getType() != Type::String) {
+                if (required) {
+                    error(op.getType() == Type::Object ? "missing or non-string member" : "operation is not an object", key);
+                }
+                return nullptr;
+            }
+            return v->getCString();
+        }
+        static JSON& operand(JSON& op, const char* path) {
+            JSON* v = op.getObject().find("value");
+            if (v == nullptr) {
+                error("missing \"value\"", path);
+            }
+            return *v;
+        }
+
+        static std::string escape(std::string_view key) {
+            std::string s;
+            for (char c : key) {
+                if (c == '~') {
+                    s += "~0";
+                } else if (c == '/') {
+                    s += "~1";
+                } else {
+                    s += c;
+                }
+            }
+            return s;
+        }
+        static void emit(JSON& ops, const char* op, const std::string& path, JSON* value) {
+            JSON o(new JSONMap());
+            JSONMap& m = o.getObject();
+            m.get("op").setString(dupcstr(op, strlen(op)), true);
+            m.get("path").setString(dupcstr(path), true);
+            if (value != nullptr) {
+                m.get("value") = value->clone();
+            }
+            ops.getArray().append(std::move(o));
+        }
+        static void diff(JSON& a, JSON& b, const std::string& path, JSON& ops) {
+            Type ta = a.getType();
+            Type tb = b.getType();
+            if (ta == Type::Object && tb == Type::Object) {
+                JSONMap& oa = a.getObject();
+                JSONMap& ob = b.getObject();
+                for (JSONMap::Entry& e : oa) {
+                    std::string_view k(e.key, e.length);
+                    JSON* vb = ob.find(k);
+                    if (vb == nullptr) {
+                        emit(ops, "remove", path + "/" + escape(k), nullptr);
+                    } else {
+                        diff(e.value, *vb, path + "/" + escape(k), ops);
+                    }
+                }
+                for (JSONMap::Entry& e : ob) {
+                    std::string_view k(e.key, e.length);
+                    if (oa.find(k) == nullptr) {
+                        emit(ops, "add", path + "/" + escape(k), &e.value);
+                    }
+                }
+            } else if (ta == Type::Array && tb == Type::Array) {
+                JSON::JSONArray& aa = a.getArray();
+                JSON::JSONArray& ab = b.getArray();
+                // unchanged members at the end are skipped, so an insert or removal near the front
+                // doesn't turn into a replacement of every following member
+                jsize_t n = aa.length < ab.length ? aa.length : ab.length;
+                jsize_t prefix = 0;
+                while (prefix < n && equals(aa.members[prefix], ab.members[prefix])) {
+                    prefix++;
+                }
+                jsize_t suffix = 0;
+                while (suffix < n - prefix && equals(aa.members[aa.length-1-suffix], ab.members[ab.length-1-suffix])) {
+                    suffix++;
+                }
+                jsize_t ea = aa.length - suffix;
+                jsize_t eb = ab.length - suffix;
+                jsize_t i = prefix;
+                for (; i<ea && i<eb; i++) {
+                    diff(aa.members[i], ab.members[i], path + "/" + std::to_string(i), ops);
+                }
+                for (jsize_t k=ea; k>i; k--) {
+                    emit(ops, "remove", path + "/" + std::to_string(i), nullptr);
+                }
+                for (; i<eb; i++) {
+                    emit(ops, "add", path + "/" + std::to_string(i), &ab.members[i]);
+                }
+            } else if (!equals(a, b)) {
+                emit(ops, "replace", path, &b);
+            }
+        }
+
+        public:
+        /* Returns true if a and b are deeply equal. Numbers are compared by value, so 1 equals 1.0. */
+        static bool equals(JSON& a, JSON& b) {
+            Type ta = a.getType();
+            Type tb = b.getType();
+            if ((ta == Type::Integer || ta == Type::Float) && (tb == Type::Integer || tb == Type::Float)) {
+                if (ta == Type::Integer && tb == Type::Integer) {
+                    return a.getInteger() == b.getInteger();
+                }
+                return a.getNumber() == b.getNumber();
+            }
+            if (ta != tb) {
+                return false;
+            }
+            switch (ta) {
+                case Type::Boolean:
+                    return a.getBoolean() == b.getBoolean();
+                case Type::String:
+                    return !strcmp(a.getCString(), b.getCString());
+                case Type::Array: {
+                    JSON::JSONArray& aa = a.getArray();
+                    JSON::JSONArray& ab = b.getArray();
+                    if (aa.length != ab.length) {
+                        return false;
+                    }
+                    for (jsize_t i=0; i<aa.length; i++) {
+                        if (!equals(aa.members[i], ab.members[i])) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                case Type::Object: {
+                    JSONMap& oa = a.getObject();
+                    JSONMap& ob = b.getObject();
+                    if (oa.length() != ob.length()) {
+                        return false;
+                    }
+                    for (JSONMap::Entry& e : oa) {
+                        JSON* vb = ob.find(std::string_view(e.key, e.length));
+                        if (vb == nullptr || !equals(e.value, *vb)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                default:
+                    return ta == Type::Null || ta == Type::Empty || a.getCustomValue() == b.getCustomValue();
+            }
+        }
+
+        /* Apply an RFC 6902 JSON Patch (an array of operations) to doc.
+           Patches are atomic: if an operation fails or a test doesn't match, the operations before it are undone,
+           then a message is printed and std::exception thrown. Values are copied out of patch. */
+        static void apply(JSON& doc, JSON& patch) {
+            if (patch.getType() != Type::Array) {
+                error("patch is not an array", "");
+            }
+            std::vector<Undo> undo;
+            try {
+                JSON::JSONArray& ops = patch.getArray();
+                for (jsize_t i=0; i<ops.length; i++) {
+                    JSON& op = ops.members[i];
+                    const char* name = member(op, "op");
+                    const char* path = member(op, "path");
+                    Steps steps = Pointer(path).getSteps();
+                    if (!strcmp(name, "add")) {
+                        JSON v = operand(op, path).clone();
+                        add(doc, steps, v, undo, path);
+                    } else if (!strcmp(name, "remove")) {
+                        JSON v = removeAt(doc, steps, path);
+                        undo.push_back({Undo::Add, steps, std::move(v)});
+                    } else if (!strcmp(name, "replace")) {
+                        JSON v = operand(op, path).clone();
+                        JSON old = replaceAt(doc, steps, v, path);
+                        undo.push_back({Undo::Replace, steps, std::move(old)});
+                    } else if (!strcmp(name, "move")) {
+                        const char* from = member(op, "from");
+                        jsize_t fl = strlen(from);
+                        if (!strncmp(from, path, fl) && path[fl] == '/') {
+                            error("cannot move a value into itself", path);
+                        }
+                        if (!strcmp(from, path)) {
+                            continue;
+                        }
+                        Steps fs = Pointer(from).getSteps();
+                        JSON v = removeAt(doc, fs, from);
+                        try {
+                            JSON old;
+                            Steps to = steps;
+                            bool replaced = addAt(doc, to, v, old, path);
+                            undo.push_back({Undo::Add, fs, JSON(), true});
+                            if (replaced) {
+                                undo.push_back({Undo::Replace, to, std::move(old)});
+                            } else {
+                                undo.push_back({Undo::Remove, to, JSON()});
+                            }
+                        } catch (...) {
+                            // put the value back where it came from before rolling back the rest
+                            JSON old;
+                            addAt(doc, fs, v, old, from);
+                            throw;
+                        }
+                    } else if (!strcmp(name, "copy")) {
+                        const char* from = member(op, "from");
+                        Steps fs = Pointer(from).getSteps();
+                        JSON* v = resolve(doc, fs, fs.size());
+                        if (v == nullptr) {
+                            error("value does not exist", from);
+                        }
+                        JSON c = v->clone();
+                        add(doc, steps, c, undo, path);
+                    } else if (!strcmp(name, "test")) {
+                        JSON* v = resolve(doc, steps, steps.size());
+                        if (v == nullptr || !equals(*v, operand(op, path))) {
+                            error("test failed", path);
+                        }
+                    } else {
+                        error("unknown operation", name);
+                    }
+                }
+            } catch (...) {
+                rollback(doc, undo);
+                throw;
+            }
+        }
+
+        /* Apply an RFC 7396 JSON Merge Patch to doc: members of patch replace those in doc, null members are removed.
+           Values are copied out of patch. */
+        static void merge(JSON& doc, JSON& patch) {
+            if (patch.getType() != Type::Object) {
+                doc = patch.clone();
+                return;
+            }
+            if (doc.getType() != Type::Object) {
+                doc.setObject(new JSONMap());
+            }
+            JSONMap& o = doc.getObject();
+            for (JSONMap::Entry& e : patch.getObject()) {
+                if (e.value.isNull()) {
+                    o.remove(std::string_view(e.key, e.length));
+                } else {
+                    merge(o.get(std::string_view(e.key, e.length)), e.value);
+                }
+            }
+        }
+
+        /* Returns an RFC 6902 JSON Patch that turns a into b.
+           Array members are compared position by position after skipping a common prefix and suffix. */
+        static JSON diff(JSON& a, JSON& b) {
+            JSON ops(new JSON::JSONArray(0));
+            diff(a, b, "", ops);
+            return ops;
+        }
+    };
+}
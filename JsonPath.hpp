@@ -0,0 +1,622 @@
+/* JSON Pointer (RFC 6901) and JSONPath queries over JSON trees.
+ * Queries are compiled once into a list of steps with their keys pre-hashed, and evaluated read-only:
+ * missing members are simply not matched, nothing is ever inserted into the tree.
+ * A PathSet evaluates many queries in a single traversal, sharing the work for common prefixes.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  JSON::Pointer ptr("/users/0/name");
+ *  JSON::JSON* name = ptr.get(root);
+ *  JSON::Path path("$.users[?(@.age >= 18)].name");
+ *  std::vector<JSON::JSON*> names = path.select(root);
+ */
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "Json.hpp"
+
+namespace JSON {
+    /* A compiled JSONPath query.
+     * Supported syntax:
+     *  $           the root (optional at the start)
+     *  .name       object member, also ['name'] or ["name"]
+     *  [n]         array member, negative indices count from the end
+     *  .* [*]      every member of an array or object
+     *  [a:b:c]     array slice, as in Python, any part may be left out
+     *  ..name      name (or *, or a bracket step) at any depth
+     *  [?(@.x op literal)]  members whose x compares true against a number, string, true, false or null
+     *              with op one of == != < <= > >=, or [?(@.x)] for members that have x
+     * Results point into the tree and are invalidated when the tree is modified.
+     */
+    class Path {
+        public:
+        class Step {
+            public:
+            enum Kind {
+                Key,
+                Index,
+                // a JSON Pointer token, which is an object key or an array index depending on the value
+                Child,
+                Wildcard,
+                Slice,
+                Descend,
+                Filter,
+            };
+            enum Op {
+                Exists,
+                Equal,
+                NotEqual,
+                Less,
+                LessEqual,
+                Greater,
+                GreaterEqual,
+            };
+            Kind kind;
+            // canonical source text, so equal steps can be shared in a PathSet
+            std::string src;
+            std::string key;
+            size_t hash = 0;
+            // Index and Child; -1 for a Child token that isn't an array index
+            jlong_t index = 0;
+            jlong_t start = 0;
+            jlong_t end = 0;
+            jlong_t step = 1;
+            bool hasStart = false;
+            bool hasEnd = false;
+            // Filter operand, relative to the member being tested
+            std::vector<Step> operand;
+            Op op = Exists;
+            Type litType = Type::Empty;
+            std::string litString;
+            jdouble_t litNumber = 0;
+            bool litBoolean = false;
+        };
+
+        protected:
+        std::vector<Step> steps;
+        std::string source;
+
+        [[noreturn]] void error(const char* msg, const char* at) {
+            printf("Invalid JSON path at offset %llu: %s\n", (unsigned long long)(at - source.c_str()), msg);
+            throw std::exception();
+        }
+
+        static inline bool isspace(char c) {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+        static inline bool isdigit(char c) {
+            return c >= '0' && c <= '9';
+        }
+        static void skipspace(const char*& p, const char* end) {
+            while (p < end && isspace(*p)) {
+                p++;
+            }
+        }
+        bool readInteger(const char*& p, const char* end, jlong_t& v) {
+            const char* s = p;
+            bool neg = p < end && *p == '-';
+            if (neg) {
+                p++;
+            }
+            if (p >= end || !isdigit(*p)) {
+                p = s;
+                return false;
+            }
+            v = 0;
+            while (p < end && isdigit(*p)) {
+                v = v * 10 + (*p++ - '0');
+            }
+            if (neg) {
+                v = -v;
+            }
+            return true;
+        }
+        std::string readQuoted(const char*& p, const char* end) {
+            char q = *p++;
+            std::string s;
+            while (p < end && *p != q) {
+                if (*p == '\\' && p + 1 < end) {
+                    p++;
+                }
+                s += *p++;
+            }
+            if (p >= end) {
+                error("unterminated string", p);
+            }
+            p++;
+            return s;
+        }
+        static Step key(std::string name) {
+            Step s;
+            s.kind = Step::Key;
+            s.key = name;
+            s.hash = JSONMap::hash(s.key.c_str());
+            s.src = "['" + name + "']";
+            return s;
+        }
+        void readFilter(const char*& p, const char* end, Step& s) {
+            const char* begin = p;
+            skipspace(p, end);
+            if (p >= end || *p != '@') {
+                error("expected '@' in filter", p);
+            }
+            p++;
+            parseSteps(p, end, s.operand, true);
+            skipspace(p, end);
+            static const char* ops[] = {"==", "!=", "<=", ">=", "<", ">"};
+            static const Step::Op opkinds[] = {Step::Equal, Step::NotEqual, Step::LessEqual, Step::GreaterEqual, Step::Less, Step::Greater};
+            s.op = Step::Exists;
+            for (int i=0; i<6; i++) {
+                jsize_t n = strlen(ops[i]);
+                if ((jsize_t)(end - p) >= n && !memcmp(p, ops[i], n)) {
+                    s.op = opkinds[i];
+                    p += n;
+                    break;
+                }
+            }
+            if (s.op != Step::Exists) {
+                skipspace(p, end);
+                if (p < end && *p == '\'') {
+                    s.litType = Type::String;
+                    s.litString = readQuoted(p, end);
+                } else {
+                    Tokenizer t(p, end - p);
+                    Tokenizer::Token tok;
+                    try {
+                        tok = t.next();
+                    } catch (ParseError& e) {
+                        error("invalid literal in filter", p + e.offset);
+                    }
+                    switch (tok) {
+                        case Tokenizer::String:
+                            s.litType = Type::String;
+                            s.litString.assign(t.s, t.slen);
+                            break;
+                        case Tokenizer::Integer:
+                            s.litType = Type::Float;
+                            s.litNumber = t.i;
+                            break;
+                        case Tokenizer::Float:
+                            s.litType = Type::Float;
+                            s.litNumber = t.d;
+                            break;
+                        case Tokenizer::True:
+                        case Tokenizer::False:
+                            s.litType = Type::Boolean;
+                            s.litBoolean = tok == Tokenizer::True;
+                            break;
+                        case Tokenizer::Null:
+                            s.litType = Type::Null;
+                            break;
+                        default:
+                            error("invalid literal in filter", p);
+                    }
+                    p += t.tell();
+                }
+                skipspace(p, end);
+            }
+            if (p >= end || *p != ')') {
+                error("expected ')' after filter", p);
+            }
+            s.src = "[?(" + std::string(begin, p - begin) + ")]";
+            p++;
+        }
+        // the step inside [...], with p just past the '['
+        void readBracket(const char*& p, const char* end, std::vector<Step>& out) {
+            const char* begin = p - 1;
+            skipspace(p, end);
+            Step s;
+            if (p < end && (*p == '\'' || *p == '"')) {
+                s = key(readQuoted(p, end));
+            } else if (p < end && *p == '*') {
+                p++;
+                s.kind = Step::Wildcard;
+            } else if (p < end && *p == '?') {
+                p++;
+                if (p >= end || *p != '(') {
+                    error("expected '(' after '?'", p);
+                }
+                p++;
+                s.kind = Step::Filter;
+                readFilter(p, end, s);
+            } else {
+                jlong_t v;
+                bool first = readInteger(p, end, v);
+                skipspace(p, end);
+                if (p < end && *p == ':') {
+                    s.kind = Step::Slice;
+                    if ((s.hasStart = first)) {
+                        s.start = v;
+                    }
+                    p++;
+                    skipspace(p, end);
+                    if ((s.hasEnd = readInteger(p, end, v))) {
+                        s.end = v;
+                    }
+                    skipspace(p, end);
+                    if (p < end && *p == ':') {
+                        p++;
+                        skipspace(p, end);
+                        if (readInteger(p, end, v)) {
+                            s.step = v;
+                        }
+                    }
+                } else if (first) {
+                    s.kind = Step::Index;
+                    s.index = v;
+                } else {
+                    error("expected a key, index, slice, '*' or filter", p);
+                }
+            }
+            skipspace(p, end);
+            if (p >= end || *p != ']') {
+                error("expected ']'", p);
+            }
+            p++;
+            if (s.kind != Step::Key) {
+                s.src.assign(begin, p - begin);
+            }
+            out.push_back(s);
+        }
+        // parse steps until the end, or in a filter operand until something that can't start a step
+        void parseSteps(const char*& p, const char* end, std::vector<Step>& out, bool operand) {
+            while (p < end) {
+                if (*p == '.') {
+                    p++;
+                    if (p < end && *p == '.') {
+                        p++;
+                        Step d;
+                        d.kind = Step::Descend;
+                        d.src = "..";
+                        out.push_back(d);
+                        if (p < end && *p == '[') {
+                            continue;
+                        }
+                    }
+                    if (p < end && *p == '*') {
+                        p++;
+                        Step s;
+                        s.kind = Step::Wildcard;
+                        s.src = "[*]";
+                        out.push_back(s);
+                        continue;
+                    }
+                    const char* n = p;
+                    while (p < end && *p != '.' && *p != '[' && !isspace(*p) &&
+                        !(operand && (*p == ')' || *p == '=' || *p == '!' || *p == '<' || *p == '>'))) {
+                        p++;
+                    }
+                    if (p == n) {
+                        error("expected a member name", p);
+                    }
+                    out.push_back(key(std::string(n, p - n)));
+                } else if (*p == '[') {
+                    p++;
+                    readBracket(p, end, out);
+                } else if (operand) {
+                    return;
+                } else {
+                    error("expected '.' or '['", p);
+                }
+            }
+        }
+
+        Path() {}
+
+        public:
+        /* Compile a JSONPath expression. Prints a message and throws std::exception on invalid syntax. */
+        Path(const char* expr) : Path(std::string(expr)) {}
+        Path(std::string expr) {
+            source = expr;
+            const char* p = source.c_str();
+            const char* end = p + source.length();
+            if (p < end && *p == '$') {
+                p++;
+            }
+            parseSteps(p, end, steps, false);
+        }
+
+        /* Returns the expression this Path was compiled from. */
+        inline const std::string& toString() const {
+            return source;
+        }
+        inline const std::vector<Step>& getSteps() const {
+            return steps;
+        }
+
+        /* Call f(JSON&) for each value matched by step s in v. */
+        template<class F>
+        static void apply(const Step& s, JSON& v, F&& f) {
+            switch (s.kind) {
+                case Step::Key:
+                    if (v.getType() == Type::Object) {
+                        JSON* c = v.getObject().find(s.key.c_str(), s.hash);
+                        if (c != nullptr) {
+                            f(*c);
+                        }
+                    }
+                    break;
+                case Step::Child:
+                    if (v.getType() == Type::Object) {
+                        JSON* c = v.getObject().find(s.key.c_str(), s.hash);
+                        if (c != nullptr) {
+                            f(*c);
+                        }
+                    } else if (v.getType() == Type::Array && s.index >= 0 && (jsize_t)s.index < v.getArray().length) {
+                        f(v.getArray().members[s.index]);
+                    }
+                    break;
+                case Step::Index:
+                    if (v.getType() == Type::Array) {
+                        JSON::JSONArray& a = v.getArray();
+                        jlong_t i = s.index < 0 ? (jlong_t)a.length + s.index : s.index;
+                        if (i >= 0 && (jsize_t)i < a.length) {
+                            f(a.members[i]);
+                        }
+                    }
+                    break;
+                case Step::Wildcard:
+                    members(v, f);
+                    break;
+                case Step::Slice: {
+                    if (v.getType() != Type::Array || s.step == 0) {
+                        break;
+                    }
+                    JSON::JSONArray& a = v.getArray();
+                    jlong_t n = a.length;
+                    auto clamp = [n](jlong_t i, jlong_t lo, jlong_t hi) {
+                        i = i < 0 ? n + i : i;
+                        return i < lo ? lo : (i > hi ? hi : i);
+                    };
+                    if (s.step > 0) {
+                        jlong_t lo = s.hasStart ? clamp(s.start, 0, n) : 0;
+                        jlong_t hi = s.hasEnd ? clamp(s.end, 0, n) : n;
+                        for (jlong_t i=lo; i<hi; i+=s.step) {
+                            f(a.members[i]);
+                        }
+                    } else {
+                        jlong_t hi = s.hasStart ? clamp(s.start, -1, n - 1) : n - 1;
+                        jlong_t lo = s.hasEnd ? clamp(s.end, -1, n - 1) : -1;
+                        for (jlong_t i=hi; i>lo; i+=s.step) {
+                            f(a.members[i]);
+                        }
+                    }
+                    break;
+                }
+                case Step::Descend:
+                    descend(v, f);
+                    break;
+                case Step::Filter:
+                    members(v, [&](JSON& c) {
+                        if (test(s, c)) {
+                            f(c);
+                        }
+                    });
+                    break;
+            }
+        }
+
+        /* Append every value matched in root to out. */
+        void select(JSON& root, std::vector<JSON*>& out) const {
+            walk(steps.data(), steps.data() + steps.size(), root, [&](JSON& v) {
+                out.push_back(&v);
+            });
+        }
+        /* Returns every value matched in root. */
+        std::vector<JSON*> select(JSON& root) const {
+            std::vector<JSON*> out;
+            select(root, out);
+            return out;
+        }
+        /* Returns the first value matched in root, or nullptr. */
+        JSON* first(JSON& root) const {
+            JSON* r = nullptr;
+            walk(steps.data(), steps.data() + steps.size(), root, [&](JSON& v) {
+                if (r == nullptr) {
+                    r = &v;
+                }
+            });
+            return r;
+        }
+        /* Returns true if anything in root matches. */
+        inline bool matches(JSON& root) const {
+            return first(root) != nullptr;
+        }
+
+        private:
+        // call f with every member of an array or object
+        template<class F>
+        static void members(JSON& v, F&& f) {
+            if (v.getType() == Type::Array) {
+                JSON::JSONArray& a = v.getArray();
+                for (jsize_t i=0; i<a.length; i++) {
+                    f(a.members[i]);
+                }
+            } else if (v.getType() == Type::Object) {
+                for (JSONMap::Entry& e : v.getObject()) {
+                    f(e.value);
+                }
+            }
+        }
+        template<class F>
+        static void descend(JSON& v, F& f) {
+            f(v);
+            members(v, [&](JSON& c) {
+                descend(c, f);
+            });
+        }
+        template<class F>
+        static void walk(const Step* s, const Step* end, JSON& v, F&& f) {
+            if (s == end) {
+                f(v);
+                return;
+            }
+            apply(*s, v, [&](JSON& c) {
+                walk(s + 1, end, c, f);
+            });
+        }
+        template<class T>
+        static bool compare(T a, T b, Step::Op op) {
+            switch (op) {
+                case Step::Equal: return a == b;
+                case Step::NotEqual: return a != b;
+                case Step::Less: return a < b;
+                case Step::LessEqual: return a <= b;
+                case Step::Greater: return a > b;
+                case Step::GreaterEqual: return a >= b;
+                default: return true;
+            }
+        }
+        static bool test(const Step& s, JSON& c) {
+            JSON* v = nullptr;
+            walk(s.operand.data(), s.operand.data() + s.operand.size(), c, [&](JSON& m) {
+                if (v == nullptr) {
+                    v = &m;
+                }
+            });
+            if (s.op == Step::Exists || v == nullptr) {
+                return v != nullptr;
+            }
+            Type t = v->getType();
+            if (s.litType == Type::Float && (t == Type::Integer || t == Type::Float)) {
+                return compare(v->getNumber(), s.litNumber, s.op);
+            }
+            if (s.litType == Type::String && t == Type::String) {
+                return compare(strcmp(v->getCString(), s.litString.c_str()), 0, s.op);
+            }
+            if ((s.litType == Type::Boolean && t == Type::Boolean) || (s.litType == Type::Null && t == Type::Null)) {
+                bool eq = s.litType == Type::Null || v->getBoolean() == s.litBoolean;
+                return s.op == Step::Equal ? eq : (s.op == Step::NotEqual ? !eq : false);
+            }
+            // values of different types are never equal or ordered
+            return s.op == Step::NotEqual;
+        }
+    };
+
+    /* A compiled JSON Pointer (RFC 6901), such as "/users/0/name".
+     * "~1" and "~0" in a token stand for '/' and '~'. A token addresses an object member, or an array member if it is an index.
+     */
+    class Pointer : public Path {
+        public:
+        /* Compile a JSON Pointer. Prints a message and throws std::exception on invalid syntax. */
+        Pointer(const char* ptr) : Pointer(std::string(ptr)) {}
+        Pointer(std::string ptr) {
+            source = ptr;
+            const char* p = source.c_str();
+            const char* end = p + source.length();
+            if (p < end && *p != '/') {
+                error("a JSON Pointer must be empty or start with '/'", p);
+            }
+            while (p < end) {
+                const char* begin = p++;
+                Step s;
+                s.kind = Step::Child;
+                while (p < end && *p != '/') {
+                    if (*p == '~') {
+                        if (p + 1 >= end || (p[1] != '0' && p[1] != '1')) {
+                            error("'~' must be followed by '0' or '1'", p);
+                        }
+                        s.key += p[1] == '0' ? '~' : '/';
+                        p += 2;
+                    } else {
+                        s.key += *p++;
+                    }
+                }
+                s.hash = JSONMap::hash(s.key.c_str());
+                // array indices are digits without leading zeros
+                s.index = -1;
+                const char* k = s.key.c_str();
+                if (s.key.length() > 0 && s.key.length() < 19 && isdigit(k[0]) && (k[0] != '0' || s.key.length() == 1)) {
+                    s.index = 0;
+                    for (const char* c=k; *c; c++) {
+                        if (!isdigit(*c)) {
+                            s.index = -1;
+                            break;
+                        }
+                        s.index = s.index * 10 + (*c - '0');
+                    }
+                }
+                s.src.assign(begin, p - begin);
+                steps.push_back(s);
+            }
+        }
+        /* Returns the value the pointer refers to in root, or nullptr. */
+        inline JSON* get(JSON& root) const {
+            return first(root);
+        }
+        inline bool has(JSON& root) const {
+            return first(root) != nullptr;
+        }
+    };
+
+    /* Evaluates many Paths (or Pointers) in one traversal of a tree.
+     * The queries are merged into a trie of steps, so a prefix shared by several queries is only walked once.
+     */
+    class PathSet {
+        class Node {
+            public:
+            Path::Step step;
+            std::vector<Node> children;
+            // ids of the queries that end at this node
+            std::vector<jsize_t> ids;
+        };
+        Node root;
+        jsize_t count = 0;
+
+        void walk(const Node& n, JSON& v, std::vector<std::vector<JSON*>>& out) const {
+            for (jsize_t id : n.ids) {
+                out[id].push_back(&v);
+            }
+            for (const Node& c : n.children) {
+                Path::apply(c.step, v, [&](JSON& m) {
+                    walk(c, m, out);
+                });
+            }
+        }
+
+        public:
+        /* Add a query, returning its id (its index in the results). */
+        jsize_t add(const Path& path) {
+            Node* n = &root;
+            for (const Path::Step& s : path.getSteps()) {
+                Node* next = nullptr;
+                for (Node& c : n->children) {
+                    if (c.step.kind == s.kind && c.step.src == s.src) {
+                        next = &c;
+                        break;
+                    }
+                }
+                if (next == nullptr) {
+                    n->children.emplace_back();
+                    next = &n->children.back();
+                    next->step = s;
+                }
+                n = next;
+            }
+            n->ids.push_back(count);
+            return count++;
+        }
+        jsize_t add(const char* expr) {
+            return add(Path(expr));
+        }
+        /* Returns the number of queries. */
+        inline jsize_t length() {
+            return count;
+        }
+        /* Evaluate every query on root. out[id] receives the matches of query id. */
+        void select(JSON& root, std::vector<std::vector<JSON*>>& out) const {
+            out.assign(count, std::vector<JSON*>());
+            walk(this->root, root, out);
+        }
+        std::vector<std::vector<JSON*>> select(JSON& root) const {
+            std::vector<std::vector<JSON*>> out;
+            select(root, out);
+            return out;
+        }
+    };
+}
@@ -0,0 +1,225 @@
+/* SIMD byte classification kernels used by the JSON tokenizer.
+ * SSE2 and AVX2 versions are compiled on x86-64 GCC/Clang and picked at runtime, with a scalar fallback elsewhere.
+ * Define JSON_SCAN_SCALAR before including this file to force the scalar kernels.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(JSON_SCAN_SCALAR) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define JSON_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace JSON {
+    namespace scan {
+        /* Bitmasks for one 64-byte block, bit n is set if byte n belongs to the class. */
+        struct Block {
+            uint64_t whitespace;
+            uint64_t quote;
+            uint64_t backslash;
+            // one of {}[]:,
+            uint64_t structural;
+        };
+
+        /* Returns the first byte in [p, end) that ends a plain string run ('"', '\\' or a control character), or end. */
+        typedef const char* (*StringFn)(const char* p, const char* end);
+        /* Returns the first non-whitespace byte in [p, end), or end. */
+        typedef const char* (*SpaceFn)(const char* p, const char* end);
+        /* Classify 64 bytes starting at p. p must have 64 readable bytes. */
+        typedef void (*ClassifyFn)(const char* p, Block& b);
+
+        inline bool isspace(char c) {
+            return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+        }
+        inline bool isstructural(char c) {
+            return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+        }
+        inline int ctz(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+            return __builtin_ctzll(v);
+#else
+            int n = 0;
+            while (!(v & 1)) {
+                v >>= 1;
+                n++;
+            }
+            return n;
+#endif
+        }
+
+        inline const char* stringScalar(const char* p, const char* end) {
+            while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) {
+                p++;
+            }
+            return p;
+        }
+        inline const char* spaceScalar(const char* p, const char* end) {
+            while (p < end && isspace(*p)) {
+                p++;
+            }
+            return p;
+        }
+        inline void classifyScalar(const char* p, Block& b) {
+            b.whitespace = b.quote = b.backslash = b.structural = 0;
+            for (int i=0; i<64; i++) {
+                uint64_t bit = 1ull << i;
+                char c = p[i];
+                if (isspace(c)) {
+                    b.whitespace |= bit;
+                } else if (c == '"') {
+                    b.quote |= bit;
+                } else if (c == '\\') {
+                    b.backslash |= bit;
+                } else if (isstructural(c)) {
+                    b.structural |= bit;
+                }
+            }
+        }
+
+#ifdef JSON_SCAN_X86
+        inline __m128i stringMask16(__m128i v) {
+            __m128i q = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+            __m128i bs = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+            // unsigned v <= 0x1F
+            __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v);
+            return _mm_or_si128(_mm_or_si128(q, bs), ctl);
+        }
+        inline __m128i spaceMask16(__m128i v) {
+            __m128i a = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+            __m128i b = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+            return _mm_or_si128(a, b);
+        }
+        inline __m128i structuralMask16(__m128i v) {
+            __m128i a = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')), _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+            __m128i b = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')), _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+            __m128i c = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+            return _mm_or_si128(_mm_or_si128(a, b), c);
+        }
+
+        inline const char* stringSSE2(const char* p, const char* end) {
+            while (end - p >= 16) {
+                __m128i v = _mm_loadu_si128((const __m128i*)p);
+                int m = _mm_movemask_epi8(stringMask16(v));
+                if (m) {
+                    return p + ctz(m);
+                }
+                p += 16;
+            }
+            return stringScalar(p, end);
+        }
+        inline const char* spaceSSE2(const char* p, const char* end) {
+            while (end - p >= 16) {
+                __m128i v = _mm_loadu_si128((const __m128i*)p);
+                int m = ~_mm_movemask_epi8(spaceMask16(v)) & 0xFFFF;
+                if (m) {
+                    return p + ctz(m);
+                }
+                p += 16;
+            }
+            return spaceScalar(p, end);
+        }
+        inline void classifySSE2(const char* p, Block& b) {
+            b.whitespace = b.quote = b.backslash = b.structural = 0;
+            for (int i=0; i<4; i++) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(p + i*16));
+                int s = i*16;
+                b.whitespace |= (uint64_t)(uint16_t)_mm_movemask_epi8(spaceMask16(v)) << s;
+                b.quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << s;
+                b.backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << s;
+                b.structural |= (uint64_t)(uint16_t)_mm_movemask_epi8(structuralMask16(v)) << s;
+            }
+        }
+
+        __attribute__((target("avx2")))
+        inline __m256i stringMask32(__m256i v) {
+            __m256i q = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+            __m256i bs = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+            __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1F)), v);
+            return _mm256_or_si256(_mm256_or_si256(q, bs), ctl);
+        }
+        __attribute__((target("avx2")))
+        inline __m256i spaceMask32(__m256i v) {
+            __m256i a = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+            __m256i b = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+            return _mm256_or_si256(a, b);
+        }
+        __attribute__((target("avx2")))
+        inline __m256i structuralMask32(__m256i v) {
+            __m256i a = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')));
+            __m256i b = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')));
+            __m256i c = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+            return _mm256_or_si256(_mm256_or_si256(a, b), c);
+        }
+
+        __attribute__((target("avx2")))
+        inline const char* stringAVX2(const char* p, const char* end) {
+            while (end - p >= 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i*)p);
+                uint32_t m = (uint32_t)_mm256_movemask_epi8(stringMask32(v));
+                if (m) {
+                    return p + ctz(m);
+                }
+                p += 32;
+            }
+            return stringSSE2(p, end);
+        }
+        __attribute__((target("avx2")))
+        inline const char* spaceAVX2(const char* p, const char* end) {
+            while (end - p >= 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i*)p);
+                uint32_t m = ~(uint32_t)_mm256_movemask_epi8(spaceMask32(v));
+                if (m) {
+                    return p + ctz(m);
+                }
+                p += 32;
+            }
+            return spaceSSE2(p, end);
+        }
+        __attribute__((target("avx2")))
+        inline void classifyAVX2(const char* p, Block& b) {
+            __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+            __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+            b.whitespace = (uint64_t)(uint32_t)_mm256_movemask_epi8(spaceMask32(lo))
+                | (uint64_t)(uint32_t)_mm256_movemask_epi8(spaceMask32(hi)) << 32;
+            __m256i q = _mm256_set1_epi8('"');
+            b.quote = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, q))
+                | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, q)) << 32;
+            __m256i bs = _mm256_set1_epi8('\\');
+            b.backslash = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, bs))
+                | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, bs)) << 32;
+            b.structural = (uint64_t)(uint32_t)_mm256_movemask_epi8(structuralMask32(lo))
+                | (uint64_t)(uint32_t)_mm256_movemask_epi8(structuralMask32(hi)) << 32;
+        }
+#endif
+
+        /* The kernels selected for this CPU. */
+        struct Kernels {
+            StringFn string;
+            SpaceFn space;
+            ClassifyFn classify;
+            const char* name;
+        };
+
+        inline Kernels detect() {
+#ifdef JSON_SCAN_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                return {stringAVX2, spaceAVX2, classifyAVX2, "avx2"};
+            }
+            return {stringSSE2, spaceSSE2, classifySSE2, "sse2"};
+#else
+            return {stringScalar, spaceScalar, classifyScalar, "scalar"};
+#endif
+        }
+
+        /* Kernels for the running CPU, detected once on first use. */
+        inline const Kernels& kernels() {
+            static const Kernels k = detect();
+            return k;
+        }
+    }
+}
@@ -0,0 +1,633 @@
+/* Streaming (SAX-style) JSON parser.
+ * Input is fed in chunks of any size and events are delivered to a Handler without building a tree,
+ * so memory use is bounded by the nesting depth and the longest single string, not the size of the input.
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  class Counter : public JSON::Handler {
+ *      public:
+ *      size_t n = 0;
+ *      bool key(const char* s, JSON::jsize_t len) { n++; return true; }
+ *  };
+ *  Counter c;
+ *  JSON::StreamParser parser(&c);
+ *  parser.parse(stdin);
+ */
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Buffer.hpp"
+#include "Json.hpp"
+
+namespace JSON {
+    /* Receives events from a StreamParser. Override the events you need.
+     * Returning false from an event pauses the parser; feed() then returns early and the rest of the chunk can be fed again to resume.
+     * String and key data is only valid during the call and is not NUL-terminated. */
+    class Handler {
+        public:
+        virtual ~Handler() {}
+        virtual bool startObject() { return true; }
+        virtual bool endObject() { return true; }
+        virtual bool startArray() { return true; }
+        virtual bool endArray() { return true; }
+        virtual bool key(const char* /*s*/, jsize_t /*len*/) { return true; }
+        virtual bool string(const char* /*s*/, jsize_t /*len*/) { return true; }
+        virtual bool integer(jlong_t /*i*/) { return true; }
+        virtual bool floating(jdouble_t /*d*/) { return true; }
+        virtual bool boolean(bool /*b*/) { return true; }
+        virtual bool null() { return true; }
+        /* Called after each complete top-level value. */
+        virtual bool document() { return true; }
+    };
+
+    /* Resumable push parser. Feed it chunks with feed() and call finish() at the end of input. */
+    class StreamParser {
+        enum State {
+            ExpectValue,
+            ExpectValueOrEnd,
+            ExpectKeyOrEnd,
+            ExpectKey,
+            ExpectColon,
+            ExpectNext,
+            ExpectEnd,
+        };
+        enum Lex {
+            None,
+            InString,
+            InEscape,
+            InNumber,
+            InLiteral,
+        };
+        static const jsize_t READ_SIZE = 64 * 1024;
+
+        Handler* handler;
+        State state = ExpectValue;
+        Lex lex = None;
+        bool multiple;
+        bool iskey = false;
+        bool pending = false;
+        jsize_t maxdepth;
+        jsize_t documents = 0;
+        // one entry per open container, '{' or '['
+        std::vector<char> stack;
+        // string and number data that spans chunks; reused so steady-state parsing does not allocate
+        std::string strbuf;
+        std::string numbuf;
+        // start of a string in the current chunk that has not needed copying yet
+        const char* strdirect = nullptr;
+        char esc[16];
+        int esclen = 0;
+        int escneed = 0;
+        const char* literal = nullptr;
+        int litpos = 0;
+        int litlen = 0;
+        Tokenizer::Token littoken = Tokenizer::Null;
+        // position tracking for error messages
+        const char* chunk = nullptr;
+        jsize_t consumed = 0;
+        jsize_t lines = 1;
+        jsize_t linestart = 0;
+        const scan::Kernels& kernels;
+
+        [[noreturn]] void error(const char* msg, const char* at) {
+            jsize_t line = lines;
+            jsize_t ls = linestart;
+            for (const char* c=chunk; c<at; c++) {
+                if (*c == '\n') {
+                    line++;
+                    ls = consumed + (c - chunk) + 1;
+                }
+            }
+            jsize_t offset = consumed + (at - chunk);
+            throw ParseError(offset, line, offset - ls + 1, msg);
+        }
+
+        static bool isnumchar(char c) {
+            return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'x' || c == 'X'
+                || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+        }
+
+        // r is the handler's result for the value that just completed
+        bool afterValue(bool r) {
+            if (stack.empty()) {
+                documents++;
+                state = multiple ? ExpectValue : ExpectEnd;
+                if (!r) {
+                    // deliver document() when the parser is resumed
+                    pending = true;
+                    return false;
+                }
+                return handler->document();
+            }
+            state = ExpectNext;
+            return r;
+        }
+
+        bool emitString(const char* s, jsize_t len) {
+            if (iskey) {
+                state = ExpectColon;
+                return handler->key(s, len);
+            }
+            return afterValue(handler->string(s, len));
+        }
+
+        bool emitNumber(const char* at) {
+            Tokenizer t(numbuf.data(), numbuf.length());
+            Tokenizer::Token tok = Tokenizer::End;
+            try {
+                tok = t.next();
+                if (t.next() != Tokenizer::End) {
+                    tok = Tokenizer::End;
+                }
+            } catch (ParseError&) {
+                tok = Tokenizer::End;
+            }
+            bool r;
+            if (tok == Tokenizer::Integer) {
+                r = handler->integer(t.i);
+            } else if (tok == Tokenizer::Float) {
+                r = handler->floating(t.d);
+            } else {
+                error("invalid number", at);
+            }
+            return afterValue(r);
+        }
+
+        bool emitLiteral() {
+            bool r;
+            if (littoken == Tokenizer::True) {
+                r = handler->boolean(true);
+            } else if (littoken == Tokenizer::False) {
+                r = handler->boolean(false);
+            } else {
+                r = handler->null();
+            }
+            return afterValue(r);
+        }
+
+        // decode a complete escape sequence in esc by running it through the Tokenizer
+        void decodeEscape(const char* at) {
+            char tmp[20];
+            tmp[0] = '"';
+            memcpy(&tmp[1], esc, esclen);
+            tmp[esclen + 1] = '"';
+            Tokenizer t(tmp, esclen + 2);
+            try {
+                t.next();
+            } catch (ParseError&) {
+                error("invalid escape sequence", at);
+            }
+            strbuf.append(t.s, t.slen);
+        }
+
+        static int hexval(const char* h) {
+            int v = 0;
+            for (int i=0; i<4; i++) {
+                char c = h[i];
+                v <<= 4;
+                if (c >= '0' && c <= '9') {
+                    v |= c - '0';
+                } else if (c >= 'a' && c <= 'f') {
+                    v |= c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                    v |= c - 'A' + 10;
+                } else {
+                    return -1;
+                }
+            }
+            return v;
+        }
+
+        bool beginValue(const char* p, const char*& next) {
+            char c = *p;
+            next = p + 1;
+            switch (c) {
+                case '{':
+                case '[':
+                    if (stack.size() >= maxdepth) {
+                        error("nesting too deep", p);
+                    }
+                    stack.push_back(c);
+                    if (c == '{') {
+                        state = ExpectKeyOrEnd;
+                        return handler->startObject();
+                    }
+                    state = ExpectValueOrEnd;
+                    return handler->startArray();
+                case '"':
+                    iskey = false;
+                    lex = InString;
+                    strbuf.clear();
+                    strdirect = next;
+                    return true;
+                case 't':
+                    literal = "true";
+                    littoken = Tokenizer::True;
+                    break;
+                case 'f':
+                    literal = "false";
+                    littoken = Tokenizer::False;
+                    break;
+                case 'n':
+                    literal = "null";
+                    littoken = Tokenizer::Null;
+                    break;
+                default:
+                    if (c == '-' || (c >= '0' && c <= '9')) {
+                        lex = InNumber;
+                        numbuf.assign(1, c);
+                        return true;
+                    }
+                    error("unexpected character", p);
+            }
+            lex = InLiteral;
+            litpos = 1;
+            litlen = strlen(literal);
+            return true;
+        }
+
+        bool close(const char* p) {
+            char c = *p;
+            char open = c == '}' ? '{' : '[';
+            if (stack.empty() || stack.back() != open) {
+                error(c == '}' ? "unexpected '}'" : "unexpected ']'", p);
+            }
+            stack.pop_back();
+            return afterValue(c == '}' ? handler->endObject() : handler->endArray());
+        }
+
+        public:
+        /* Construct a parser delivering events to handler.
+           When multiple is true the input may contain any number of whitespace-separated top-level values (e.g. NDJSON). */
+        StreamParser(Handler* handler, bool multiple=true, jsize_t maxdepth=1024) : kernels(scan::kernels()) {
+            this->handler = handler;
+            this->multiple = multiple;
+            this->maxdepth = maxdepth;
+        }
+
+        /* Returns the number of complete top-level values parsed so far. */
+        inline jsize_t count() {
+            return documents;
+        }
+        /* Returns the number of input bytes consumed so far. */
+        inline jsize_t tell() {
+            return consumed;
+        }
+
+        /* Parse the next chunk of input. Throws ParseError on invalid input.
+           Returns the number of bytes consumed, which is less than len only if the handler paused the parser. */
+        jsize_t feed(const char* data, jsize_t len) {
+            const char* p = data;
+            const char* end = data + len;
+            chunk = data;
+            if (pending) {
+                pending = false;
+                if (!handler->document()) {
+                    return 0;
+                }
+            }
+            bool go = true;
+            while (p < end && go) {
+                switch (lex) {
+                    case InString: {
+                        const char* q = kernels.string(p, end);
+                        if (q >= end) {
+                            strbuf.append(strdirect != nullptr ? strdirect : p, end - (strdirect != nullptr ? strdirect : p));
+                            strdirect = nullptr;
+                            p = end;
+                            break;
+                        }
+                        if (*q == '"') {
+                            lex = None;
+                            if (strdirect != nullptr) {
+                                const char* s = strdirect;
+                                strdirect = nullptr;
+                                p = q + 1;
+                                go = emitString(s, q - s);
+                            } else {
+                                strbuf.append(p, q - p);
+                                p = q + 1;
+                                go = emitString(strbuf.data(), strbuf.length());
+                            }
+                        } else if (*q == '\\') {
+                            strbuf.append(strdirect != nullptr ? strdirect : p, q - (strdirect != nullptr ? strdirect : p));
+                            strdirect = nullptr;
+                            esc[0] = '\\';
+                            esclen = 1;
+                            escneed = 2;
+                            lex = InEscape;
+                            p = q + 1;
+                        } else {
+                            error("control character in string", q);
+                        }
+                        break;
+                    }
+                    case InEscape: {
+                        char c = *p;
+                        esc[esclen++] = c;
+                        if (esclen == 2) {
+                            if (c == 'x') {
+                                escneed = 4;
+                            } else if (c == 'u') {
+                                escneed = 6;
+                            } else if (!strchr("\"\\/bfnrt0", c) || c == 0) {
+                                error("invalid escape sequence", p);
+                            }
+                        } else if (esclen == 6 && escneed == 6 && esc[1] == 'u') {
+                            int v = hexval(&esc[2]);
+                            if (v >= 0xD800 && v < 0xDC00) {
+                                // high surrogate, the low half follows as another \u escape
+                                escneed = 12;
+                            }
+                        }
+                        p++;
+                        if (esclen == escneed) {
+                            decodeEscape(p);
+                            lex = InString;
+                        }
+                        break;
+                    }
+                    case InNumber: {
+                        const char* q = p;
+                        while (q < end && isnumchar(*q)) {
+                            q++;
+                        }
+                        numbuf.append(p, q - p);
+                        p = q;
+                        if (q < end) {
+                            lex = None;
+                            go = emitNumber(q);
+                        }
+                        break;
+                    }
+                    case InLiteral: {
+                        if (*p != literal[litpos]) {
+                            error("invalid literal", p);
+                        }
+                        p++;
+                        if (++litpos == litlen) {
+                            lex = None;
+                            go = emitLiteral();
+                        }
+                        break;
+                    }
+                    case None: {
+                        if (scan::isspace(*p)) {
+                            p = kernels.space(p + 1, end);
+                            if (p >= end) {
+                                break;
+                            }
+                        }
+                        char c = *p;
+                        switch (state) {
+                            case ExpectKeyOrEnd:
+                                if (c == '}') {
+                                    go = close(p++);
+                                    break;
+                                }
+                                // fall through
+                            case ExpectKey:
+                                if (c != '"') {
+                                    error("expected string key", p);
+                                }
+                                p++;
+                                iskey = true;
+                                lex = InString;
+                                strbuf.clear();
+                                strdirect = p;
+                                break;
+                            case ExpectColon:
+                                if (c != ':') {
+                                    error("expected ':'", p);
+                                }
+                                p++;
+                                state = ExpectValue;
+                                break;
+                            case ExpectNext:
+                                if (c == ',') {
+                                    p++;
+                                    state = stack.back() == '{' ? ExpectKey : ExpectValue;
+                                } else if (c == '}' || c == ']') {
+                                    go = close(p++);
+                                } else {
+                                    error(stack.back() == '{' ? "expected ',' or '}'" : "expected ',' or ']'", p);
+                                }
+                                break;
+                            case ExpectValueOrEnd:
+                                if (c == ']') {
+                                    go = close(p++);
+                                    break;
+                                }
+                                // fall through
+                            case ExpectValue:
+                                go = beginValue(p, p);
+                                break;
+                            case ExpectEnd:
+                                error("unexpected data after document", p);
+                        }
+                        break;
+                    }
+                }
+            }
+            // keep line numbers for errors in later chunks
+            for (const char* c = (const char*)memchr(data, '\n', p - data); c != nullptr;
+                 c = (const char*)memchr(c + 1, '\n', p - c - 1)) {
+                lines++;
+                linestart = consumed + (c - data) + 1;
+            }
+            consumed += p - data;
+            // a direct string pointer does not survive into the next chunk
+            if (strdirect != nullptr) {
+                strbuf.append(strdirect, p - strdirect);
+                strdirect = nullptr;
+            }
+            chunk = nullptr;
+            return p - data;
+        }
+
+        /* Signal the end of input, completing a trailing top-level number. Throws ParseError if a value is incomplete.
+           Returns false if the handler paused the parser, in which case finish() should be called again. */
+        bool finish() {
+            const char* at = "";
+            chunk = at;
+            bool r = true;
+            if (pending) {
+                pending = false;
+                r = handler->document();
+            } else if (lex == InNumber) {
+                lex = None;
+                r = emitNumber(at);
+            } else if (lex == InString || lex == InEscape) {
+                error("unterminated string", at);
+            } else if (lex == InLiteral) {
+                error("invalid literal", at);
+            } else if (!stack.empty() || (state != ExpectValue && state != ExpectEnd)) {
+                error("unexpected end of input", at);
+            } else if (!multiple && documents == 0) {
+                error("unexpected end of input", at);
+            }
+            return r;
+        }
+
+        /* Reset the parser to parse a new input. */
+        void reset() {
+            state = ExpectValue;
+            lex = None;
+            pending = false;
+            documents = 0;
+            stack.clear();
+            strbuf.clear();
+            strdirect = nullptr;
+            consumed = 0;
+            lines = 1;
+            linestart = 0;
+        }
+
+        /* Parse everything read from source, which fills a buffer and returns the number of bytes read (0 at the end).
+           Returns false if the handler stopped the parser. */
+        bool parse(const std::function<jsize_t(char*, jsize_t)>& source) {
+            std::vector<char> buf(READ_SIZE);
+            jsize_t n;
+            while ((n = source(buf.data(), buf.size())) > 0) {
+                if (feed(buf.data(), n) < n) {
+                    return false;
+                }
+            }
+            return finish();
+        }
+        /* Parse everything until the end of a FILE*. Returns false if the handler stopped the parser. */
+        bool parse(FILE* fd) {
+            return parse([fd](char* buf, jsize_t len) -> jsize_t {
+                return fread(buf, 1, len, fd);
+            });
+        }
+        /* Parse everything until the end of a file descriptor. Returns false if the handler stopped the parser. */
+        bool parse(int fd) {
+            return parse([fd](char* buf, jsize_t len) -> jsize_t {
+#ifdef _WIN32
+                int n = _read(fd, buf, (unsigned int)len);
+#else
+                ssize_t n = read(fd, buf, len);
+#endif
+                return n > 0 ? n : 0;
+            });
+        }
+        /* Parse the remaining data of an RWBuffer. Returns false if the handler stopped the parser. */
+        bool parse(RWBuffer<char>& in) {
+            return parse([&in](char* buf, jsize_t len) -> jsize_t {
+                return in.read(buf, len);
+            });
+        }
+    };
+
+    /* Pull-style reader built on StreamParser: call next() to get one event at a time from a chunked source. */
+    class EventReader : protected Handler {
+        public:
+        enum Event {
+            End = 0,
+            StartObject,
+            EndObject,
+            StartArray,
+            EndArray,
+            Key,
+            String,
+            Integer,
+            Float,
+            Boolean,
+            Null,
+            EndDocument,
+        };
+        // value of the most recent Key/String/Integer/Float/Boolean event. s is valid until the next call to next().
+        const char* s = nullptr;
+        jsize_t slen = 0;
+        jlong_t i = 0;
+        jdouble_t d = 0;
+        bool b = false;
+
+        /* Read events from source, which fills a buffer and returns the number of bytes read (0 at the end). */
+        EventReader(std::function<jsize_t(char*, jsize_t)> source, bool multiple=true)
+            : parser(this, multiple), source(source), buf(READ_SIZE) {}
+        EventReader(FILE* fd, bool multiple=true) : EventReader([fd](char* buf, jsize_t len) -> jsize_t {
+            return fread(buf, 1, len, fd);
+        }, multiple) {}
+        EventReader(RWBuffer<char>& in, bool multiple=true) : EventReader([&in](char* buf, jsize_t len) -> jsize_t {
+            return in.read(buf, len);
+        }, multiple) {}
+
+        /* Returns the next event, or End at the end of input. Throws ParseError on invalid input. */
+        Event next() {
+            event = End;
+            while (event == End) {
+                if (pos >= len) {
+                    if (done) {
+                        return End;
+                    }
+                    len = finished ? 0 : source(buf.data(), buf.size());
+                    pos = 0;
+                    if (len == 0) {
+                        finished = true;
+                        done = parser.finish();
+                        return event;
+                    }
+                }
+                pos += parser.feed(buf.data() + pos, len - pos);
+            }
+            return event;
+        }
+
+        protected:
+        static const jsize_t READ_SIZE = 64 * 1024;
+        StreamParser parser;
+        std::function<jsize_t(char*, jsize_t)> source;
+        std::vector<char> buf;
+        jsize_t pos = 0;
+        jsize_t len = 0;
+        bool finished = false;
+        bool done = false;
+        Event event = End;
+
+        bool emit(Event e) {
+            event = e;
+            return false;
+        }
+        bool startObject() { return emit(StartObject); }
+        bool endObject() { return emit(EndObject); }
+        bool startArray() { return emit(StartArray); }
+        bool endArray() { return emit(EndArray); }
+        bool key(const char* s, jsize_t len) {
+            this->s = s;
+            this->slen = len;
+            return emit(Key);
+        }
+        bool string(const char* s, jsize_t len) {
+            this->s = s;
+            this->slen = len;
+            return emit(String);
+        }
+        bool integer(jlong_t i) {
+            this->i = i;
+            return emit(Integer);
+        }
+        bool floating(jdouble_t d) {
+            this->d = d;
+            return emit(Float);
+        }
+        bool boolean(bool b) {
+            this->b = b;
+            return emit(Boolean);
+        }
+        bool null() { return emit(Null); }
+        bool document() { return emit(EndDocument); }
+    };
+}
@@ -0,0 +1,495 @@
+/* Flat tape representation of a parsed JSON document.
+ * The whole document is stored in one array of tagged 64-bit words in document order, with strings in a separate buffer,
+ * so traversal reads memory sequentially instead of chasing a pointer per node.
+ * Containers record where they end, so a subtree is skipped in O(1).
+ * Author: Adam "beckadamtheinventor" Beckingham
+ * License: MIT
+ * Usage:
+ *  JSON::TapeDocument doc(data, len);
+ *  for (auto it = doc.root()["items"].begin(); it != doc.root()["items"].end(); ++it) {
+ *      long long id = (*it)["id"].getInteger();
+ *  }
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Arena.hpp"
+#include "Json.hpp"
+
+namespace JSON {
+    class TapeValue;
+
+    /* A read-only JSON document stored as a tape.
+     * Each word holds a tag in its top byte and a 56-bit payload:
+     *  '{' '[' : bits 0-31 are the tape index just past the matching close word, bits 32-55 the member count (saturating)
+     *  '}' ']' : the tape index of the matching open word
+     *  '"'     : the offset of the string in the string buffer, where it is stored as a 32-bit length, the bytes and a NUL
+     *  'l' 'd' : an integer or float, whose 64 bits are stored in the following word
+     *  't' 'f' 'n' : true, false, null
+     * Object members are stored as a key string followed by the value.
+     */
+    class TapeDocument {
+        friend class TapeValue;
+        static const uint64_t PAYLOAD = 0x00FFFFFFFFFFFFFFull;
+        static const uint64_t MAX_COUNT = 0xFFFFFF;
+        static const jsize_t MAX_DEPTH = 1024;
+        std::vector<uint64_t> tape;
+        std::vector<char> strings;
+
+        static inline uint64_t word(char tag, uint64_t payload) {
+            return ((uint64_t)(uint8_t)tag << 56) | payload;
+        }
+        inline char tag(jsize_t i) {
+            return (char)(tape[i] >> 56);
+        }
+        inline uint64_t payload(jsize_t i) {
+            return tape[i] & PAYLOAD;
+        }
+        // tape index just past the value at i
+        inline jsize_t skip(jsize_t i) {
+            switch (tag(i)) {
+                case '{':
+                case '[':
+                    return (uint32_t)payload(i);
+                case 'l':
+                case 'd':
+                    return i + 2;
+                default:
+                    return i + 1;
+            }
+        }
+
+        void addString(const char* s, jsize_t len) {
+            jsize_t off = strings.size();
+            uint32_t n = len;
+            strings.resize(off + 4 + len + 1);
+            memcpy(&strings[off], &n, 4);
+            memcpy(&strings[off + 4], s, len);
+            strings[off + 4 + len] = 0;
+            tape.push_back(word('"', off));
+        }
+        void addScalar(Tokenizer& t, Tokenizer::Token tok) {
+            switch (tok) {
+                case Tokenizer::String:
+                    addString(t.s, t.slen);
+                    break;
+                case Tokenizer::Integer:
+                    tape.push_back(word('l', 0));
+                    tape.push_back((uint64_t)t.i);
+                    break;
+                case Tokenizer::Float: {
+                    uint64_t bits;
+                    memcpy(&bits, &t.d, 8);
+                    tape.push_back(word('d', 0));
+                    tape.push_back(bits);
+                    break;
+                }
+                case Tokenizer::True:
+                    tape.push_back(word('t', 0));
+                    break;
+                case Tokenizer::False:
+                    tape.push_back(word('f', 0));
+                    break;
+                case Tokenizer::Null:
+                    tape.push_back(word('n', 0));
+                    break;
+                case Tokenizer::End:
+                    t.error("unexpected end of input");
+                default:
+                    t.error("unexpected token");
+            }
+        }
+
+        // emit an object key, returning the token that starts its value
+        Tokenizer::Token key(Tokenizer& t, Tokenizer::Token tok) {
+            if (tok != Tokenizer::String) {
+                t.error("expected string key");
+            }
+            addString(t.s, t.slen);
+            if (t.next() != Tokenizer::Colon) {
+                t.error("expected ':'");
+            }
+            return t.next();
+        }
+
+        // iterative, so deep documents only grow the open container stack
+        void build(Tokenizer& t) {
+            tape.clear();
+            strings.clear();
+            // tape index and member count of each open container
+            std::vector<jsize_t> open;
+            std::vector<jsize_t> counts;
+            auto close = [&]() {
+                jsize_t o = open.back();
+                jsize_t n = counts.back() < MAX_COUNT ? counts.back() : MAX_COUNT;
+                bool object = tag(o) == '{';
+                tape.push_back(word(object ? '}' : ']', o));
+                tape[o] = word(object ? '{' : '[', ((uint64_t)n << 32) | tape.size());
+                open.pop_back();
+                counts.pop_back();
+            };
+            Tokenizer::Token tok = t.next();
+            while (true) {
+                // tok starts a value
+                if (!open.empty()) {
+                    counts.back()++;
+                }
+                if (tok == Tokenizer::BeginObject || tok == Tokenizer::BeginArray) {
+                    if (open.size() >= MAX_DEPTH) {
+                        t.error("nesting too deep");
+                    }
+                    bool object = tok == Tokenizer::BeginObject;
+                    open.push_back(tape.size());
+                    counts.push_back(0);
+                    tape.push_back(word(object ? '{' : '[', 0));
+                    tok = t.next();
+                    if (tok == (object ? Tokenizer::EndObject : Tokenizer::EndArray)) {
+                        close();
+                    } else {
+                        if (object) {
+                            tok = key(t, tok);
+                        }
+                        continue;
+                    }
+                } else {
+                    addScalar(t, tok);
+                }
+                // after a value, close containers until one continues with another member
+                while (true) {
+                    if (open.empty()) {
+                        if (t.next() != Tokenizer::End) {
+                            t.error("unexpected data after document");
+                        }
+                        return;
+                    }
+                    bool object = tag(open.back()) == '{';
+                    tok = t.next();
+                    if (tok == Tokenizer::Comma) {
+                        tok = t.next();
+                        if (object) {
+                            tok = key(t, tok);
+                        }
+                        break;
+                    } else if (tok == (object ? Tokenizer::EndObject : Tokenizer::EndArray)) {
+                        close();
+                    } else {
+                        t.error(object ? "expected ',' or '}'" : "expected ',' or ']'");
+                    }
+                }
+            }
+        }
+
+        public:
+        TapeDocument() {}
+        /* Parse a NUL-terminated JSON document. Throws ParseError on invalid input. */
+        TapeDocument(const char* data) : TapeDocument(data, strlen(data)) {}
+        /* Parse len bytes of JSON. Throws ParseError on invalid input. */
+        TapeDocument(const char* data, jsize_t len) {
+            parse(data, len);
+        }
+        /* Parse len bytes of JSON, replacing the previous contents. Throws ParseError on invalid input. */
+        void parse(const char* data, jsize_t len) {
+            // a tape has at most one word per input byte plus one, and tape indices are 32 bits
+            if (len >= UINT32_MAX / 2) {
+                printf("JSON::TapeDocument input too large (max 2GB)\n");
+                throw std::exception();
+            }
+            tape.reserve(len / 4);
+            strings.reserve(len / 2);
+            Tokenizer t(data, len);
+            build(t);
+        }
+        /* Returns the number of words on the tape. */
+        inline jsize_t tapeLength() {
+            return tape.size();
+        }
+        /* Returns the size of the string buffer in bytes. */
+        inline jsize_t stringsLength() {
+            return strings.size();
+        }
+        /* Returns the root value. */
+        TapeValue root();
+    };
+
+    /* A value on a TapeDocument's tape. Only valid as long as the TapeDocument is neither destroyed nor re-parsed.
+     * Missing keys and out of range indices give an Empty value. */
+    class TapeValue {
+        TapeDocument* doc;
+        // tape index of the value's first word
+        jsize_t i;
+
+        void type_error() {
+            printf("Wrong type (0x%X) for operation\n", (unsigned int)getType());
+            throw std::exception();
+        }
+        inline char tag() {
+            return doc != nullptr ? doc->tag(i) : 0;
+        }
+        inline const char* str(jsize_t k, uint32_t& len) {
+            const char* p = &doc->strings[doc->payload(k)];
+            memcpy(&len, p, 4);
+            return p + 4;
+        }
+
+        public:
+        TapeValue() {
+            doc = nullptr;
+            i = 0;
+        }
+        TapeValue(TapeDocument* doc, jsize_t i) {
+            this->doc = doc;
+            this->i = i;
+        }
+
+        /* Iterates over the members of an array or object. */
+        class Iterator {
+            TapeDocument* doc;
+            // tape index of the current member, or of its key for objects
+            jsize_t k;
+            bool object;
+            public:
+            Iterator(TapeDocument* doc, jsize_t k, bool object) {
+                this->doc = doc;
+                this->k = k;
+                this->object = object;
+            }
+            /* Returns the key of the current object member. */
+            const char* key() {
+                return TapeValue(doc, k).getCString();
+            }
+            /* Returns the length of the current member's key, which may contain NUL characters. */
+            jsize_t keyLength() {
+                return TapeValue(doc, k).getStringLength();
+            }
+            /* Returns the current member's value. */
+            TapeValue operator*() {
+                return TapeValue(doc, object ? k + 1 : k);
+            }
+            Iterator& operator++() {
+                k = doc->skip(object ? k + 1 : k);
+                return *this;
+            }
+            bool operator!=(const Iterator& o) {
+                return k != o.k;
+            }
+        };
+
+        Iterator begin() {
+            char t = tag();
+            if (t != '{' && t != '[') {
+                type_error();
+            }
+            return Iterator(doc, i + 1, t == '{');
+        }
+        Iterator end() {
+            char t = tag();
+            if (t != '{' && t != '[') {
+                type_error();
+            }
+            // the close word
+            return Iterator(doc, doc->skip(i) - 1, t == '{');
+        }
+
+        Type getType() {
+            switch (tag()) {
+                case '{': return Type::Object;
+                case '[': return Type::Array;
+                case '"': return Type::String;
+                case 'l': return Type::Integer;
+                case 'd': return Type::Float;
+                case 't':
+                case 'f': return Type::Boolean;
+                case 'n': return Type::Null;
+                default: return Type::Empty;
+            }
+        }
+        inline bool isEmpty() {
+            return doc == nullptr;
+        }
+        inline bool isNull() {
+            return tag() == 'n';
+        }
+
+        /* Look up an object member. Members are compared by length first and their values skipped in O(1). */
+        TapeValue get(const char* key, jsize_t keylen) {
+            if (tag() != '{') {
+                type_error();
+            }
+            jsize_t end = doc->skip(i) - 1;
+            for (jsize_t k=i+1; k<end; k=doc->skip(k+1)) {
+                uint32_t len;
+                const char* s = str(k, len);
+                if (len == keylen && !memcmp(s, key, keylen)) {
+                    return TapeValue(doc, k + 1);
+                }
+            }
+            return TapeValue();
+        }
+        TapeValue operator[](const char* key) {
+            return get(key, strlen(key));
+        }
+        TapeValue operator[](std::string key) {
+            return get(key.c_str(), key.length());
+        }
+        bool contains(const char* key) {
+            return !get(key, strlen(key)).isEmpty();
+        }
+        bool contains(std::string key) {
+            return !get(key.c_str(), key.length()).isEmpty();
+        }
+        /* Get an array member by index. Members before it are skipped in O(1) each. */
+        TapeValue operator[](jsize_t n) {
+            if (tag() != '[') {
+                type_error();
+            }
+            jsize_t end = doc->skip(i) - 1;
+            for (jsize_t k=i+1; k<end; k=doc->skip(k)) {
+                if (n-- == 0) {
+                    return TapeValue(doc, k);
+                }
+            }
+            return TapeValue();
+        }
+        /* Returns the number of members of an array or object. O(1) unless there are more than 16M. */
+        jsize_t length() {
+            char t = tag();
+            if (t != '{' && t != '[') {
+                type_error();
+            }
+            jsize_t n = doc->payload(i) >> 32;
+            if (n < TapeDocument::MAX_COUNT) {
+                return n;
+            }
+            n = 0;
+            for (Iterator it = begin(); it != end(); ++it) {
+                n++;
+            }
+            return n;
+        }
+        jsize_t getArrayLength() {
+            if (tag() != '[') {
+                type_error();
+            }
+            return length();
+        }
+        jsize_t getObjectLength() {
+            if (tag() != '{') {
+                type_error();
+            }
+            return length();
+        }
+
+        /* Returns the string, which is NUL-terminated and owned by the TapeDocument. */
+        const char* getCString() {
+            if (tag() != '"') {
+                type_error();
+            }
+            uint32_t len;
+            return str(i, len);
+        }
+        jsize_t getStringLength() {
+            if (tag() != '"') {
+                type_error();
+            }
+            uint32_t len;
+            str(i, len);
+            return len;
+        }
+        std::string getString() {
+            if (tag() != '"') {
+                type_error();
+            }
+            uint32_t len;
+            const char* s = str(i, len);
+            return std::string(s, len);
+        }
+        jlong_t getInteger() {
+            if (tag() != 'l') {
+                type_error();
+            }
+            return (jlong_t)doc->tape[i + 1];
+        }
+        jsize_t getUnsigned() {
+            return getInteger();
+        }
+        jdouble_t getFloat() {
+            if (tag() != 'd') {
+                type_error();
+            }
+            jdouble_t d;
+            memcpy(&d, &doc->tape[i + 1], 8);
+            return d;
+        }
+        jdouble_t getNumber() {
+            if (tag() == 'l') {
+                return getInteger();
+            }
+            return getFloat();
+        }
+        bool getBoolean() {
+            char t = tag();
+            if (t != 't' && t != 'f') {
+                type_error();
+            }
+            return t == 't';
+        }
+
+        /* Copy this value into a JSON tree, allocated from arena if given. */
+        JSON materialize(Arena* arena=nullptr) {
+            JSON o;
+            switch (tag()) {
+                case 0:
+                    break;
+                case 'n':
+                    o.setNull();
+                    break;
+                case 't':
+                case 'f':
+                    o.setBoolean(getBoolean());
+                    break;
+                case 'l':
+                    o.setInteger(getInteger());
+                    break;
+                case 'd':
+                    o.setFloat(getFloat());
+                    break;
+                case '"': {
+                    uint32_t len;
+                    const char* s = str(i, len);
+                    if (arena != nullptr) {
+                        o.setString(arena->strdup(s, len), false);
+                    } else {
+                        o.setString(dupcstr(s, len), true);
+                    }
+                    break;
+                }
+                case '[': {
+                    jsize_t n = length();
+                    JSON::JSONArray* a = arena != nullptr ? arena->create<JSON::JSONArray>(arena, n) : new JSON::JSONArray(n);
+                    for (Iterator it = begin(); it != end(); ++it) {
+                        a->members[a->length++] = (*it).materialize(arena);
+                    }
+                    o.setArray(a);
+                    break;
+                }
+                case '{': {
+                    JSONMap* m = arena != nullptr ? arena->create<JSONMap>(arena) : new JSONMap();
+                    for (Iterator it = begin(); it != end(); ++it) {
+                        m->get(std::string_view(it.key(), it.keyLength())) = (*it).materialize(arena);
+                    }
+                    o.setObject(m);
+                    break;
+                }
+            }
+            return o;
+        }
+    };
+
+    inline TapeValue TapeDocument::root() {
+        return tape.empty() ? TapeValue() : TapeValue(this, 0);
+    }
+}
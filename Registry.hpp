@@ -1,11 +1,14 @@
 /* Simple Registry class. (integer and string keyed dictionary)
+ * DenseRegistry stores its values contiguously, addressed by handles that stay valid while other entries are removed.
  * Author: Adam "beckadamtheinventor" Beckingham
  * License: MIT
  */
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
 #include <exception>
+#include <utility>
 #include <vector>
 
 #include "Dictionary.hpp"
@@ -19,6 +22,9 @@ class Registry {
         return _entries.size();
     }
     public:
+    Registry() {}
+    /* Construct an empty registry whose keys are interned in pool, which must outlive it. */
+    Registry(StringPool<>* pool) : _dict(pool) {}
     /* Clear the registry.
      * Note that all values must be allocated with the "new" operator otherwise this will not work expectedly.
      */
@@ -27,6 +33,7 @@ class Registry {
         for (size_t i=0; i<_entries.size(); i++) {
             delete _entries[i];
         }
+        _entries.clear();
     }
     /* Get the number of registered entries. */
     size_t length() {
@@ -51,8 +58,9 @@ class Registry {
 	}
     /* Get a registry entry from a given key. */
 	T& get(const char *key) {
-		if (has(key)) {
-			return _entries[_dict[key]];
+		size_t* id = _dict.find(key);
+		if (id != nullptr) {
+			return *_entries[*id];
 		}
         printf("Registry key \"%s\" undefined.\n", key);
 		throw std::exception();
@@ -66,7 +74,7 @@ class Registry {
 		if (has(id)) {
 			return _entries[id];
 		}
-        printf("Registry ID %llu out of range.\n", id);
+        printf("Registry ID %llu out of range.\n", (unsigned long long)id);
 		throw std::exception();
 	}
     /* Get a registry key given an integer id. */
@@ -74,7 +82,247 @@ class Registry {
         if (has(id)) {
             return _dict.keys(id);
         }
-        printf("Registry ID %llu out of range.\n", id);
+        printf("Registry ID %llu out of range.\n", (unsigned long long)id);
         throw std::exception();
     }
 };
+
+/* A Registry that stores its values contiguously in one array, so systems can update every entry without chasing pointers.
+ * Entries are addressed by a Handle, a slot index and the generation of the slot. Removing an entry moves the last value into its place,
+ * but the handles of the other entries stay valid, and the removed entry's handle is rejected even after its slot is reused.
+ * Values are iterated in the packed order, which changes when entries are removed.
+ */
+template<class T>
+class DenseRegistry {
+    public:
+    /* A stable id for an entry. The default Handle refers to no entry. */
+    class Handle {
+        public:
+        uint32_t index = 0;
+        // 0 for a null handle, live slots start at generation 1
+        uint32_t generation = 0;
+        Handle() {}
+        Handle(uint32_t index, uint32_t generation) : index(index), generation(generation) {}
+        inline bool operator==(const Handle& o) const {
+            return index == o.index && generation == o.generation;
+        }
+        inline bool operator!=(const Handle& o) const {
+            return !(*this == o);
+        }
+        inline explicit operator bool() const {
+            return generation != 0;
+        }
+    };
+
+    protected:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    class Slot {
+        public:
+        // position of the value in _values, or the next free slot while unused
+        uint32_t dense;
+        uint32_t generation;
+        const char* name;
+    };
+    // packed values, and the slot owning each of them
+    std::vector<T> _values;
+    std::vector<uint32_t> _owners;
+    std::vector<Slot> _slots;
+    uint32_t _free = NONE;
+    // names map to slot indices. Names are borrowed from the slots, which own them unless they come from _pool.
+    Dictionary<uint32_t> _dict;
+    StringPool<>* _pool = nullptr;
+
+    inline Slot* live(Handle h) {
+        if (h.index < _slots.size() && _slots[h.index].generation == h.generation && h.generation != 0) {
+            return &_slots[h.index];
+        }
+        return nullptr;
+    }
+    Handle insert(const char* key, T&& value) {
+        const char* name;
+        if (_pool != nullptr) {
+            HashedKey<> k = _pool->intern(key);
+            if (_dict.find(k) != nullptr) {
+                printf("Registry key \"%s\" already defined.\n", key);
+                throw std::exception();
+            }
+            name = k.key;
+        } else {
+            if (_dict.has(key)) {
+                printf("Registry key \"%s\" already defined.\n", key);
+                throw std::exception();
+            }
+            name = _dupcstr(key);
+        }
+        if (_values.size() >= NONE) {
+            printf("Registry is full.\n");
+            throw std::exception();
+        }
+        uint32_t index = _free;
+        if (index == NONE) {
+            index = _slots.size();
+            _slots.push_back(Slot{0, 1, nullptr});
+        } else {
+            _free = _slots[index].dense;
+        }
+        Slot& slot = _slots[index];
+        slot.dense = _values.size();
+        slot.name = name;
+        _values.push_back(std::move(value));
+        _owners.push_back(index);
+        _dict.getBorrowed(name) = index;
+        return Handle(index, slot.generation);
+    }
+    // mark a slot unused, so handles to it are rejected
+    void release(uint32_t index) {
+        Slot& slot = _slots[index];
+        if (_pool == nullptr) {
+            delete[] slot.name;
+        }
+        slot.name = nullptr;
+        slot.generation = slot.generation == UINT32_MAX ? 1 : slot.generation + 1;
+        slot.dense = _free;
+        _free = index;
+    }
+
+    public:
+    DenseRegistry() {}
+    /* Construct an empty registry whose keys are interned in pool, which must outlive it. */
+    DenseRegistry(StringPool<>* pool) : _dict(pool), _pool(pool) {}
+    DenseRegistry(const DenseRegistry&) = delete;
+    DenseRegistry& operator=(const DenseRegistry&) = delete;
+    DenseRegistry(DenseRegistry&& o) {
+        *this = std::move(o);
+    }
+    DenseRegistry& operator=(DenseRegistry&& o) {
+        if (this != &o) {
+            clear();
+            _values = std::move(o._values);
+            _owners = std::move(o._owners);
+            _slots = std::move(o._slots);
+            _free = o._free;
+            _dict = std::move(o._dict);
+            _pool = o._pool;
+            o._free = NONE;
+        }
+        return *this;
+    }
+    ~DenseRegistry() {
+        clear();
+    }
+    /* Clear the registry. Every existing handle becomes invalid. */
+    void clear() {
+        _dict.clear();
+        for (uint32_t index : _owners) {
+            release(index);
+        }
+        _values.clear();
+        _owners.clear();
+    }
+    /* Make room for n entries, so adding up to n doesn't reallocate the values. */
+    void reserve(size_t n) {
+        _values.reserve(n);
+        _owners.reserve(n);
+        _slots.reserve(n);
+        _dict.reserve(n);
+    }
+    /* Get the number of registered entries. */
+    inline size_t length() {
+        return _values.size();
+    }
+    /* Add a new key:value pair to the registry, returning its handle. Throws if the key is already registered. */
+    Handle add(const char* key, T value) {
+        return insert(key, std::move(value));
+    }
+    /* Create a new key:empty pair in the registry, returning its handle. */
+    Handle create(const char* key) {
+        return insert(key, T());
+    }
+    /* Check if the registry contains a given key. */
+    inline bool has(const char* key) {
+        return _dict.has(key);
+    }
+    /* Check if a handle refers to an entry that hasn't been removed. */
+    inline bool has(Handle h) {
+        return live(h) != nullptr;
+    }
+    /* Get the handle of a key, or a null handle if it isn't registered. */
+    Handle handle(const char* key) {
+        uint32_t* index = _dict.find(key);
+        if (index == nullptr) {
+            return Handle();
+        }
+        return Handle(*index, _slots[*index].generation);
+    }
+    /* Get a pointer to the value of a handle, or nullptr if its entry was removed. */
+    inline T* find(Handle h) {
+        Slot* slot = live(h);
+        return slot == nullptr ? nullptr : &_values[slot->dense];
+    }
+    /* Get a pointer to the value of a key, or nullptr if it isn't registered. */
+    inline T* find(const char* key) {
+        uint32_t* index = _dict.find(key);
+        return index == nullptr ? nullptr : &_values[_slots[*index].dense];
+    }
+    /* Get a registry entry from a given key. */
+    T& get(const char* key) {
+        T* v = find(key);
+        if (v != nullptr) {
+            return *v;
+        }
+        printf("Registry key \"%s\" undefined.\n", key);
+        throw std::exception();
+    }
+    /* Get a registry entry from a handle. Throws if the entry was removed. */
+    T& get(Handle h) {
+        T* v = find(h);
+        if (v != nullptr) {
+            return *v;
+        }
+        printf("Registry handle %u:%u is stale.\n", h.index, h.generation);
+        throw std::exception();
+    }
+    /* Get the key of a handle, or nullptr if its entry was removed. */
+    const char* keys(Handle h) {
+        Slot* slot = live(h);
+        return slot == nullptr ? nullptr : slot->name;
+    }
+    /* Remove an entry. The last value is moved into its place. Returns false if the entry was already removed. */
+    bool remove(Handle h) {
+        Slot* slot = live(h);
+        if (slot == nullptr) {
+            return false;
+        }
+        _dict.remove(slot->name);
+        uint32_t i = slot->dense;
+        uint32_t last = _values.size() - 1;
+        if (i != last) {
+            _values[i] = std::move(_values[last]);
+            _owners[i] = _owners[last];
+            _slots[_owners[i]].dense = i;
+        }
+        _values.pop_back();
+        _owners.pop_back();
+        release(h.index);
+        return true;
+    }
+    /* Remove the entry of a key. Returns false if the key isn't registered. */
+    bool remove(const char* key) {
+        return remove(handle(key));
+    }
+
+    /* The packed values, in no particular order. Adding or removing entries invalidates the pointer. */
+    inline T* data() {
+        return _values.data();
+    }
+    inline T* begin() {
+        return _values.data();
+    }
+    inline T* end() {
+        return _values.data() + _values.size();
+    }
+    /* Get the handle of the value at position i of the packed array. */
+    inline Handle at(size_t i) {
+        return Handle(_owners[i], _slots[_owners[i]].generation);
+    }
+};
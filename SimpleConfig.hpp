@@ -24,6 +24,7 @@
 
 
 #include "Dictionary.hpp"
+#include "NumberParse.hpp"
 #include <cstdio>
 #include <ios>
 #include <cmath>
@@ -188,38 +189,31 @@ namespace SimpleConfig {
                     success = false;
                 }
             } else if (c == '-' || c >= '0' && c <= '9') {
-                size_t n = 0;
-                size_t f = 0;
-                size_t fl = 0;
-                bool negative = false;
-                if (c == '-') {
-                    negative = true;
+                std::string text;
+                char prev = 0;
+                while ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || (c == '-' && text.empty()) ||
+                       ((c == '+' || c == '-') && (prev == 'e' || prev == 'E'))) {
+                    text.push_back(c);
+                    prev = c;
                     c = in->get();
                 }
-                while (c >= '0' && c <= '9') {
-                    n = n * 10 + c - '0';
-                    c = in->get();
-                    if (c == '.') {
-                        fl++;
-                    }
-                }
-                if (fl > 0) {
-                    while (c >= '0' && c <= '9') {
-                        f = f * 10 + c - '0';
-                        fl++;
-                        c = in->get();
-                    }
+                NumberParse::Decimal num;
+                const char* end = text.data() + text.size();
+                if (NumberParse::scan(text.data(), end, num) != end) {
+                    success = false;
+                } else if (!num.integer) {
                     v.type = TDOUBLE;
-                    v.d = (double)n + (double)f * powl(0.1, fl-1);
+                    success = NumberParse::toDouble(num, text.data(), text.size(), v.d) == NumberParse::Ok;
+                } else if (num.negative) {
+                    long long i = 0;
+                    success = NumberParse::toInteger(num, i) == NumberParse::Ok;
+                    v.type = TINTEGER;
+                    v.i = i;
                 } else {
-                    if (negative) {
-                        v.type = TINTEGER;
-                        v.i = -(long long)n;
-                    } else {
-                        v.type = TUNSIGNED;
-                        v.u = n;
-                    }
-                    
+                    unsigned long long u = 0;
+                    success = NumberParse::toUnsigned(num, u) == NumberParse::Ok;
+                    v.type = TUNSIGNED;
+                    v.u = u;
                 }
                 in->unget();
             } else if (c == '"') {
@@ -482,10 +476,11 @@ namespace SimpleConfig {
             dict->get(key) = Value::fromString(v);
         }
         bool setRaw(const char* key, const void* v) {
-            if (!dict->has(key)) {
+            Value* found = dict->find(key);
+            if (found == nullptr) {
                 return false;
             }
-            Value& val = dict->get(key);
+            Value& val = *found;
             switch (val.type) {
                 case Value::TNONE:
                     break;
@@ -633,12 +628,10 @@ namespace SimpleConfig {
         // Note: this does not write a header.
         bool serialize(std::ostream *out) {
             char buf[256];
-            size_t nkeys = dict->length();
-            for (size_t i=0; i<nkeys; i++) {
-                // printf("Index %llu\n", i);
-                char* key = dict->keys(i);
+            for (Dictionary<Value>::Entry& e : *dict) {
+                char* key = e.key;
                 // printf("Key: %s\n", key);
-                Value val = dict->values(i);
+                Value& val = e.value;
                 // printf("Value Type: %u Value: %016llX\n", val.type, val.u);
                 size_t vl = val.serialize(buf);
                 // printf("Serialized Value Length: %llu\n", vl);